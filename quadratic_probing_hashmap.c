@@ -32,14 +32,29 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <strings.h>
 #include <string.h>
 #include <assert.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "quadratic_probing_hashmap.h"
 
-/* when we call for more capacity */
+/* when we call for more capacity, unless the map was given its own max
+ * load factor */
 #define SPACERATIO 0.5
 
+/* Robin Hood keeps probe lengths short, so we can fill up much more */
+#define ROBIN_HOOD_SPACERATIO 0.875
+
 static int __tombstone;
 
+const char hashmapq_full_marker;
+
 typedef struct hash_node_s hash_node_t;
 
 struct hash_node_s
@@ -48,314 +63,3867 @@ struct hash_node_s
     void *val;                  // the data
 };
 
-static void __ensurecapacity(
+/* old slots moved over by each operation during an incremental resize */
+#define MIGRATE_SLOTS 32
+
+/* how many keys of a batch have their hashing and loads overlapped */
+#define BATCH_WINDOW 32
+
+/* HASHMAPQ_FAST_CLEAR tracks writes to the array in runs of this many
+ * slots. A chunk of HASHMAPQ_OCCUPANCY_BITMAP is one word */
+#define CLEAR_CHUNK 64
+
+/* HASHMAPQ_SHRINK_ON_CLEAR looks at the peak count over this many clears */
+#define SHRINK_CLEARS 8
+
+/* HASHMAPQ_CONCURRENT_READS spreads reader counts over this many cache
+ * lines so readers on different cores don't bounce the same line */
+#define READER_SHARDS 64
+#define CACHE_LINE 64
+
+/* what HASHMAPQ_CONCURRENT_READS readers see; swapped out on resize */
+typedef struct
+{
+    int size;
+    hash_node_t *array;
+    unsigned int *hashes;
+} table_t;
+
+typedef struct
+{
+    /* readers inside a read section, by epoch parity */
+    long count[2];
+} __attribute__((aligned(CACHE_LINE))) reader_shard_t;
+
+static int __next_reader_shard;
+static __thread int __reader_shard = -1;
+
+/* a HASHMAPQ_LOCK_FREE array. Once full it points to its successor, and
+ * every thread that runs into it helps copy it over chunk by chunk */
+typedef struct lf_table_s
+{
+    int size;
+    /* slots claimed by a key; this is what SPACERATIO is checked against */
+    int used;
+    /* start of the next chunk handed out to a migrating thread */
+    int migrate_claim;
+    /* slots that have been copied to next */
+    int migrated;
+    struct lf_table_s *next;
+    hash_node_t array[];
+} lf_table_t;
+
+/* the journal tracks changes to the array by pages of this many slots */
+#define JOURNAL_PAGE_SLOTS (4096 / sizeof(hash_node_t))
+
+/* buffered journal records are written out once there are this many bytes,
+ * even before a commit */
+#define JOURNAL_BUF (1 << 16)
+
+/* a growable run of bytes on their way to a file */
+typedef struct
+{
+    char *p;
+    size_t len;
+    size_t cap;
+} bytes_t;
+
+/* what a map keeps while it is journaled */
+typedef struct
+{
+    int fd;
+    int checkpoint_fd;
+    func_serialize_f key_serializer;
+    func_serialize_f val_serializer;
+    /* records that haven't been written yet */
+    bytes_t buf;
+    /* pages of the array changed since the last checkpoint */
+    unsigned char *pages;
+    /* the next checkpoint has to write everything */
+    int full;
+    int err;
+} journal_t;
+
+static int __ensurecapacity(
+    hashmapq_t * h
+);
+
+static void __shrink_if_sparse(
+    hashmapq_t * h
+);
+
+static void __journal_put(
+    hashmapq_t * h,
+    void *k,
+    void *v
+);
+
+static void __journal_remove(
+    hashmapq_t * h,
+    const void *k
+);
+
+static void __journal_clear(
     hashmapq_t * h
 );
 
+static void *__put(
+    hashmapq_t * h,
+    void *k,
+    void *v,
+    unsigned long hash
+);
+
+static hash_node_t *__flooded(
+    hashmapq_t * h,
+    const void *k,
+    hash_node_t * n
+);
+
 static int is_power_of_two(unsigned int x)
 {
   return ((x != 0) && !(x & (x - 1)));
 }
 
-hashmapq_t *hashmapq_new(
-    func_longhash_f hash,
-    func_longcmp_f cmp,
-    unsigned int initial_capacity
+static void *__default_alloc(size_t size, void *udata)
+{
+    (void) udata;
+    return malloc(size);
+}
+
+static void *__default_realloc(void *ptr, size_t size, void *udata)
+{
+    (void) udata;
+    return realloc(ptr, size);
+}
+
+static void __default_free(void *ptr, void *udata)
+{
+    (void) udata;
+    free(ptr);
+}
+
+static const hashmapq_allocator_t __default_allocator = {
+    __default_alloc, __default_realloc, __default_free, NULL
+};
+
+/* maps living in a caller's buffer must never allocate, and have nothing
+ * to free */
+static void *__no_alloc(size_t size, void *udata)
+{
+    (void) size;
+    (void) udata;
+    assert(0);
+    return NULL;
+}
+
+static void *__no_realloc(void *ptr, size_t size, void *udata)
+{
+    (void) ptr;
+    return __no_alloc(size, udata);
+}
+
+static void __no_free(void *ptr, void *udata)
+{
+    (void) ptr;
+    (void) udata;
+}
+
+static const hashmapq_allocator_t __no_allocator = {
+    __no_alloc, __no_realloc, __no_free, NULL
+};
+
+/**
+ * @return zeroed memory from h's allocator */
+static void *__calloc(
+    hashmapq_t * h,
+    size_t nmemb,
+    size_t size
 )
 {
-    hashmapq_t *h;
+    void *p = h->allocator.alloc(nmemb * size, h->allocator.udata);
 
-    assert(is_power_of_two(initial_capacity));
+    if (p)
+        memset(p, 0, nmemb * size);
+    return p;
+}
 
-    h = calloc(1, sizeof(hashmapq_t));
-    h->size = initial_capacity;
-    h->array = calloc(h->size, sizeof(hash_node_t));
-    h->hash = hash;
-    h->compare = cmp;
-    return h;
+static void __free(
+    hashmapq_t * h,
+    void *ptr
+)
+{
+    if (ptr)
+        h->allocator.free(ptr, h->allocator.udata);
+}
+
+static int __nchunks(
+    int size
+)
+{
+    return (size + CLEAR_CHUNK - 1) / CLEAR_CHUNK;
 }
 
 /**
- * @return number of items within hash */
-int hashmapq_count(const hashmapq_t * h)
+ * The slot at idx of the array changed, so the next checkpoint writes its
+ * page. */
+static void __journal_mark(
+    hashmapq_t * h,
+    unsigned int idx
+)
 {
-    return h->count;
+    journal_t *j = h->journal;
+    unsigned int page = idx / JOURNAL_PAGE_SLOTS;
+
+    if (j)
+        j->pages[page / 8] |= 1 << (page % 8);
 }
 
 /**
- * @return size of the array used within hash */
-int hashmapq_size(
-    hashmapq_t * h
+ * @return number of journal pages in an array of size slots */
+static int __journal_npages(
+    int size
 )
 {
-    return h->size;
+    return (size + JOURNAL_PAGE_SLOTS - 1) / JOURNAL_PAGE_SLOTS;
 }
 
 /**
- * Empty this hash. */
-void hashmapq_clear(
+ * Start tracking a new, empty array. */
+static void __tracking_reset(
     hashmapq_t * h
 )
 {
-    int ii;
+    if (h->flags & HASHMAPQ_FAST_CLEAR)
+    {
+        __free(h, h->dirty);
+        __free(h, h->dirty_list);
+        h->dirty = __calloc(h, __nchunks(h->size) / 8 + 1, 1);
+        h->dirty_list = __calloc(h, __nchunks(h->size), sizeof(int));
+        h->ndirty = 0;
+    }
 
-    for (ii = 0; ii < h->size; ii++)
+    if (h->flags & HASHMAPQ_OCCUPANCY_BITMAP)
     {
-        hash_node_t *n;
+        __free(h, h->occupied);
+        h->occupied = __calloc(h, __nchunks(h->size),
+                               sizeof(unsigned long long));
+    }
 
-        n = &((hash_node_t *) h->array)[ii];
+    /* every entry moves, so the page layout starts over */
+    if (h->journal)
+    {
+        journal_t *j = h->journal;
 
-        if (NULL == n->key)
-            continue;
+        __free(h, j->pages);
+        j->pages = __calloc(h, __journal_npages(h->size) / 8 + 1, 1);
+        j->full = 1;
+    }
+}
 
-        if (n->key == (void*)&__tombstone)
+/**
+ * Remember that a key was put in the array at idx: its bit is set, and
+ * clear knows to wipe its chunk. */
+static void __touch(
+    hashmapq_t * h,
+    unsigned int idx
+)
+{
+    unsigned int c = idx / CLEAR_CHUNK;
+
+    __journal_mark(h, idx);
+    if (h->occupied)
+        h->occupied[c] |= 1ull << (idx % CLEAR_CHUNK);
+
+    if (!(h->flags & HASHMAPQ_FAST_CLEAR) || (h->dirty[c / 8] & (1 << (c % 8))))
+        return;
+
+    h->dirty[c / 8] |= 1 << (c % 8);
+    h->dirty_list[h->ndirty++] = c;
+}
+
+/**
+ * Forget the key that was at idx of this array. */
+static void __vacate(
+    hashmapq_t * h,
+    hash_node_t * array,
+    unsigned int idx
+)
+{
+    /* the bitmap only covers the current array */
+    if (h->occupied && array == h->array)
+        h->occupied[idx / CLEAR_CHUNK] &= ~(1ull << (idx % CLEAR_CHUNK));
+    if (array == h->array)
+        __journal_mark(h, idx);
+}
+
+static hash_node_t *__node(
+    const hashmapq_t * h,
+    unsigned int idx
+)
+{
+    return &((hash_node_t *) h->array)[idx];
+}
+
+/* wyhash's default secret */
+#define WY0 0x2d358dccaa6c78a5ull
+#define WY1 0x8bb84b93962eacc9ull
+#define WY2 0x4b33a62ed433d4a3ull
+#define WY3 0x4d5a2da51de1aa47ull
+
+/**
+ * Multiply into 128 bits.
+ * @param a,b receive the low and high halves */
+static void __mul128(
+    uint64_t * a,
+    uint64_t * b
+)
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t) *a * *b;
+
+    *a = (uint64_t) r;
+    *b = (uint64_t) (r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t) *a,
+        lb = (uint32_t) *b, rh = ha * hb, rm0 = ha * lb, rm1 = hb * la,
+        rl = la * lb, t = rl + (rm0 << 32), c = t < rl, lo;
+
+    lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static uint64_t __mum(
+    uint64_t a,
+    uint64_t b
+)
+{
+    __mul128(&a, &b);
+    return a ^ b;
+}
+
+static uint64_t __read64(
+    const unsigned char *p
+)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t __read32(
+    const unsigned char *p
+)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+unsigned long hashmapq_hash_bytes(
+    const void *key,
+    size_t len,
+    unsigned long seed
+)
+{
+    const unsigned char *p = key;
+    uint64_t a, b, s = seed;
+
+    /* wyhash */
+    s ^= __mum(s ^ WY0, WY1);
+    if (len <= 16)
+    {
+        if (4 <= len)
         {
-            n->key = NULL;
-            continue;
+            a = __read32(p) << 32 | __read32(p + ((len >> 3) << 2));
+            b = __read32(p + len - 4) << 32 |
+                __read32(p + len - 4 - ((len >> 3) << 2));
+        }
+        else if (0 < len)
+        {
+            a = (uint64_t) p[0] << 16 | (uint64_t) p[len >> 1] << 8 |
+                p[len - 1];
+            b = 0;
+        }
+        else
+            a = b = 0;
+    }
+    else
+    {
+        size_t i = len;
+
+        if (48 < i)
+        {
+            uint64_t s1 = s, s2 = s;
+
+            do
+            {
+                s = __mum(__read64(p) ^ WY1, __read64(p + 8) ^ s);
+                s1 = __mum(__read64(p + 16) ^ WY2, __read64(p + 24) ^ s1);
+                s2 = __mum(__read64(p + 32) ^ WY3, __read64(p + 40) ^ s2);
+                p += 48;
+                i -= 48;
+            }
+            while (48 < i);
+            s ^= s1 ^ s2;
+        }
+
+        for (; 16 < i; i -= 16, p += 16)
+            s = __mum(__read64(p) ^ WY1, __read64(p + 8) ^ s);
+
+        /* the last 16 bytes, overlapping what was already mixed */
+        a = __read64(p + i - 16);
+        b = __read64(p + i - 8);
+    }
+
+    a ^= WY1;
+    b ^= s;
+    __mul128(&a, &b);
+    return __mum(a ^ WY0 ^ len, b ^ WY1);
+}
+
+unsigned long hashmapq_hash_str(
+    const void *key
+)
+{
+    return hashmapq_hash_bytes(key, strlen(key), 0);
+}
+
+unsigned long hashmapq_hash_str_seeded(
+    const void *key,
+    unsigned long seed
+)
+{
+    return hashmapq_hash_bytes(key, strlen(key), seed);
+}
+
+unsigned long hashmapq_mix(
+    unsigned long hash
+)
+{
+    uint64_t x = hash;
+
+    x ^= x >> 32;
+    x *= 0xd6e8feb86659fd93ull;
+    x ^= x >> 32;
+    x *= 0xd6e8feb86659fd93ull;
+    x ^= x >> 32;
+    return x;
+}
+
+unsigned long hashmapq_hash_ptr(
+    const void *key
+)
+{
+    return hashmapq_mix((unsigned long) key);
+}
+
+unsigned long hashmapq_hash_ptr_seeded(
+    const void *key,
+    unsigned long seed
+)
+{
+    return hashmapq_hash_bytes(&key, sizeof(key), seed);
+}
+
+/**
+ * Give a caller's hash the finish it needs for slot selection. */
+static unsigned long __mix(
+    const hashmapq_t * h,
+    unsigned long hash
+)
+{
+    return h->flags & HASHMAPQ_MIX_HASH ? hashmapq_mix(hash) : hash;
+}
+
+static unsigned long __hash(
+    const hashmapq_t * h,
+    const void *key
+)
+{
+    if (h->seeded_hash)
+        return __mix(h, h->seeded_hash(key, h->seed));
+    return __mix(h, h->hash(key));
+}
+
+/**
+ * @return array index of the i-th step of the probe sequence for hash */
+static unsigned int __probe(
+    int size,
+    unsigned long hash,
+    unsigned int i
+)
+{
+    return (hash + (i/2) + (i * i)/2) % size;
+}
+
+/**
+ * The first size steps of __probe() reach only about 3/4 of the slots.
+ * @return steps it takes __probe() to visit every slot */
+static unsigned int __probe_span(
+    int size
+)
+{
+    return 2 * (unsigned int) size;
+}
+
+/* an insert probing further than this, plus a few steps per doubling of
+ * the array, is taken as a sign of flooding */
+#define FLOOD_PROBES 16
+
+static int __flood_limit(
+    const hashmapq_t * h
+)
+{
+    return FLOOD_PROBES + 4 * __builtin_ctz(h->size);
+}
+
+/**
+ * @return how far the entry at idx sits from its home slot */
+static unsigned int __rh_distance(
+    unsigned int *hashes,
+    int size,
+    unsigned int idx
+)
+{
+    return (idx - hashes[idx]) & (size - 1);
+}
+
+/**
+ * Linear probe for key. We can give up as soon as we pass an entry that is
+ * closer to its home than we are to ours, because an insert would have
+ * displaced it.
+ * @return array index of key, otherwise -1 */
+static int __rh_find(
+    hashmapq_t * h,
+    hash_node_t * array,
+    unsigned int *hashes,
+    int size,
+    const void *key,
+    unsigned long hash
+)
+{
+    unsigned int d;
+
+    for (d = 0;; d++)
+    {
+        unsigned int idx = (hash + d) & (size - 1);
+
+        if (!array[idx].key) return -1;
+        if (__rh_distance(hashes, size, idx) < d) return -1;
+
+        if (hashes[idx] == (unsigned int) hash &&
+            0 == h->compare(key, array[idx].key))
+            return idx;
+    }
+}
+
+/**
+ * Insert by displacing any entry that is closer to its home slot than the
+ * entry we are carrying.
+ * @return node holding key; the new key keeps the first slot it takes */
+static hash_node_t *__rh_insert(
+    hashmapq_t * h,
+    void *k,
+    void *v,
+    unsigned long hash,
+    int *inserted
+)
+{
+    unsigned int d, idx, mask = h->size - 1;
+    unsigned int hash32 = hash;
+    hash_node_t *placed = NULL;
+
+    for (d = 0, idx = hash & mask;; d++, idx = (idx + 1) & mask)
+    {
+        hash_node_t *n = __node(h, idx);
+        unsigned int nd;
+
+        if (!n->key)
+        {
+            n->key = k;
+            n->val = v;
+            h->hashes[idx] = hash32;
+            __touch(h, idx);
+            h->slots_used += 1;
+            h->count++;
+            if (!placed)
+                h->probes = d;
+            *inserted = 1;
+            return placed ? placed : n;
+        }
+
+        /* once we have displaced something the key can't be a duplicate */
+        if (!placed && h->hashes[idx] == hash32 &&
+            0 == h->compare(k, n->key))
+        {
+            *inserted = 0;
+            return n;
         }
 
-        n->key = NULL;
-        h->count--;
-        assert(0 <= h->count);
-    }
+        nd = __rh_distance(h->hashes, h->size, idx);
+        if (nd < d)
+        {
+            hash_node_t tmp = *n;
+            unsigned int tmp_hash = h->hashes[idx];
+
+            __journal_mark(h, idx);
+            n->key = k;
+            n->val = v;
+            h->hashes[idx] = hash32;
+            k = tmp.key;
+            v = tmp.val;
+            hash32 = tmp_hash;
+            if (!placed)
+            {
+                /* how far lookups of the new key will probe */
+                h->probes = d;
+                placed = n;
+            }
+            d = nd;
+        }
+    }
+}
+
+/**
+ * Empty slot idx by shifting the rest of its cluster back one slot.
+ * No tombstone is needed.
+ * @return index of the slot left empty */
+static unsigned int __rh_remove_at(
+    hash_node_t * array,
+    unsigned int *hashes,
+    int size,
+    unsigned int idx
+)
+{
+    for (;;)
+    {
+        unsigned int next = (idx + 1) & (size - 1);
+
+        if (!array[next].key || 0 == __rh_distance(hashes, size, next))
+            break;
+
+        array[idx] = array[next];
+        hashes[idx] = hashes[next];
+        idx = next;
+    }
+
+    array[idx].key = NULL;
+    return idx;
+}
+
+/**
+ * Probe this array for key.
+ * The compare callback is skipped when the cached hashes differ.
+ * @return array index of key, otherwise -1 */
+static int __find(
+    hashmapq_t * h,
+    hash_node_t * array,
+    unsigned int *hashes,
+    int size,
+    const void *key,
+    unsigned long hash
+)
+{
+    unsigned int i;
+
+    if (h->flags & HASHMAPQ_ROBIN_HOOD)
+        return __rh_find(h, array, hashes, size, key, hash);
+
+    for (i=0;;i++)
+    {
+        unsigned int new_slot;
+        hash_node_t *n;
+
+        new_slot = __probe(size, hash, i);
+        n = &array[new_slot];
+
+        if (!n->key) return -1;
+        if (n->key == (void*)&__tombstone) continue;
+        if (hashes && hashes[new_slot] != (unsigned int) hash) continue;
+
+        if (0 == h->compare(key, n->key))
+            return new_slot;
+    }
+}
+
+/**
+ * @return the calling thread's reader shard */
+static int __shard(void)
+{
+    if (-1 == __reader_shard)
+        __reader_shard = __atomic_fetch_add(&__next_reader_shard, 1,
+                                            __ATOMIC_RELAXED) % READER_SHARDS;
+    return __reader_shard;
+}
+
+int hashmapq_read_begin(
+    hashmapq_t * h
+)
+{
+    reader_shard_t *r = &((reader_shard_t *) h->readers)[__shard()];
+    int e;
+
+    e = __atomic_load_n(&h->epoch, __ATOMIC_SEQ_CST) & 1;
+    __atomic_fetch_add(&r->count[e], 1, __ATOMIC_SEQ_CST);
+    return e;
+}
+
+void hashmapq_read_end(
+    hashmapq_t * h,
+    int token
+)
+{
+    reader_shard_t *r = &((reader_shard_t *) h->readers)[__shard()];
+
+    __atomic_fetch_sub(&r->count[token], 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Wait until every reader that might have seen the previous table is gone.
+ * The epoch is flipped twice so a reader that picked up a stale parity
+ * just before the first flip is still waited for. */
+static void __synchronize(
+    hashmapq_t * h
+)
+{
+    int phase;
+
+    for (phase = 0; phase < 2; phase++)
+    {
+        int e = __atomic_fetch_xor(&h->epoch, 1, __ATOMIC_SEQ_CST) & 1;
+
+        for (;;)
+        {
+            long readers = 0;
+            int ii;
+
+            for (ii = 0; ii < READER_SHARDS; ii++)
+                readers += __atomic_load_n(
+                    &((reader_shard_t *) h->readers)[ii].count[e],
+                    __ATOMIC_SEQ_CST);
+
+            if (0 == readers)
+                break;
+            sched_yield();
+        }
+    }
+}
+
+/**
+ * Make the current arrays the ones readers see.
+ * Once this returns no reader can still be using the previous arrays, so
+ * the caller may free them. */
+static void __publish(
+    hashmapq_t * h
+)
+{
+    table_t *t, *t_old;
+
+    t = __calloc(h, 1, sizeof(table_t));
+    t->size = h->size;
+    t->array = h->array;
+    t->hashes = h->hashes;
+
+    t_old = __atomic_exchange_n((table_t **) &h->table, t, __ATOMIC_SEQ_CST);
+    if (!t_old)
+        return;
+
+    __synchronize(h);
+    __free(h, t_old);
+}
+
+/**
+ * Get this key's value from the published table.
+ * Only atomic loads are used, so this can run alongside the writer. */
+static void *__concurrent_get(
+    hashmapq_t * h,
+    const void *key,
+    unsigned long hash
+)
+{
+    void *val = NULL;
+    table_t *t;
+    unsigned int i;
+    int token;
+
+    token = hashmapq_read_begin(h);
+    t = __atomic_load_n((table_t **) &h->table, __ATOMIC_SEQ_CST);
+
+    for (i=0; i < __probe_span(t->size); i++)
+    {
+        unsigned int new_slot;
+        hash_node_t *n;
+        void *k;
+
+        new_slot = __probe(t->size, hash, i);
+        n = &t->array[new_slot];
+        k = __atomic_load_n(&n->key, __ATOMIC_ACQUIRE);
+
+        if (!k) break;
+        if (k == (void*)&__tombstone) continue;
+        if (t->hashes && t->hashes[new_slot] != (unsigned int) hash) continue;
+
+        /* a slot's key never changes once set, so its val belongs to k */
+        if (0 == h->compare(key, k))
+        {
+            val = __atomic_load_n(&n->val, __ATOMIC_ACQUIRE);
+            break;
+        }
+    }
+
+    hashmapq_read_end(h, token);
+    return val;
+}
+
+static lf_table_t *__lf_table_new(
+    hashmapq_t * h,
+    int size
+)
+{
+    lf_table_t *t;
+
+    t = __calloc(h, 1, sizeof(lf_table_t) + size * sizeof(hash_node_t));
+    t->size = size;
+    return t;
+}
+
+/**
+ * A slot's key is claimed before its val is stored.
+ * @return val once the thread that claimed the slot has stored it */
+static void *__lf_val(
+    hash_node_t * n
+)
+{
+    void *v;
+
+    while (!(v = __atomic_load_n(&n->val, __ATOMIC_ACQUIRE)))
+        sched_yield();
+    return v;
+}
+
+/**
+ * @return 1 if no more keys may be inserted into t */
+static int __lf_closed(
+    lf_table_t * t
+)
+{
+    return __atomic_load_n(&t->next, __ATOMIC_ACQUIRE) ||
+        __atomic_load_n(&t->used, __ATOMIC_RELAXED) >= t->size * SPACERATIO;
+}
+
+/**
+ * Make h->table point at the newest array whose predecessors have all been
+ * fully migrated. */
+static void __lf_advance(
+    hashmapq_t * h
+)
+{
+    lf_table_t *t, *next;
+
+    t = __atomic_load_n((lf_table_t **) &h->table, __ATOMIC_ACQUIRE);
+    while ((next = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE)) &&
+           __atomic_load_n(&t->migrated, __ATOMIC_ACQUIRE) == t->size)
+        /* on failure t becomes whatever someone else advanced to */
+        if (__atomic_compare_exchange_n((lf_table_t **) &h->table, &t,
+                                        next, 0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE))
+            t = next;
+}
+
+static hash_node_t *__lf_insert(
+    hashmapq_t * h,
+    lf_table_t * t,
+    void *k,
+    void *v,
+    unsigned long hash,
+    int *inserted
+);
+
+/**
+ * Copy one chunk of t into its successor. */
+static void __lf_help(
+    hashmapq_t * h,
+    lf_table_t * t
+)
+{
+    int ii, start, end;
+
+    if (__atomic_load_n(&t->migrate_claim, __ATOMIC_RELAXED) >= t->size)
+        return;
+
+    start = __atomic_fetch_add(&t->migrate_claim, MIGRATE_SLOTS,
+                               __ATOMIC_RELAXED);
+    if (start >= t->size)
+        return;
+    end = t->size < start + MIGRATE_SLOTS ? t->size : start + MIGRATE_SLOTS;
+
+    for (ii = start; ii < end; ii++)
+    {
+        hash_node_t *n = &t->array[ii];
+        void *key = __atomic_load_n(&n->key, __ATOMIC_ACQUIRE);
+        int inserted;
+
+        /* freeze empty slots so nothing lands behind us */
+        while (!key &&
+               !__atomic_compare_exchange_n(&n->key, &key, &__tombstone, 0,
+                                            __ATOMIC_ACQ_REL,
+                                            __ATOMIC_ACQUIRE))
+            ;
+
+        if (key && key != &__tombstone)
+            __lf_insert(h, __atomic_load_n(&t->next, __ATOMIC_ACQUIRE), key,
+                        __lf_val(n), __hash(h, key), &inserted);
+    }
+
+    if (t->size == __atomic_add_fetch(&t->migrated, end - start,
+                                      __ATOMIC_ACQ_REL))
+        __lf_advance(h);
+}
+
+/**
+ * @return t's successor, after helping to migrate t */
+static lf_table_t *__lf_next(
+    hashmapq_t * h,
+    lf_table_t * t
+)
+{
+    lf_table_t *next, *expected = NULL;
+
+    next = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE);
+    if (!next)
+    {
+        /* racing threads may all allocate; only one array wins */
+        next = __lf_table_new(h, t->size << 1);
+        if (!__atomic_compare_exchange_n(&t->next, &expected, next, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            __free(h, next);
+            next = expected;
+        }
+    }
+
+    __lf_help(h, t);
+    return next;
+}
+
+/**
+ * Find key in t or its successors, or claim a slot for it.
+ * A closed array only has its empty slots frozen, never filled, so once we
+ * move on to the next array nobody can insert key behind us.
+ * @param inserted set to 1 if key was inserted, 0 if it was already there
+ * @return node holding key */
+static hash_node_t *__lf_insert(
+    hashmapq_t * h,
+    lf_table_t * t,
+    void *k,
+    void *v,
+    unsigned long hash,
+    int *inserted
+)
+{
+    for (;; t = __lf_next(h, t))
+    {
+        int closed = __lf_closed(t);
+        unsigned int i;
+
+        for (i = 0; i < __probe_span(t->size); i++)
+        {
+            hash_node_t *n = &t->array[__probe(t->size, hash, i)];
+            void *key = __atomic_load_n(&n->key, __ATOMIC_ACQUIRE);
+
+            /* on failure key is whatever beat us to the slot */
+            while (!key &&
+                   !__atomic_compare_exchange_n(
+                       &n->key, &key, closed ? (void *) &__tombstone : k, 0,
+                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                ;
+
+            if (!key)
+            {
+                if (closed)
+                    break;
+
+                __atomic_fetch_add(&t->used, 1, __ATOMIC_RELAXED);
+                __atomic_store_n(&n->val, v, __ATOMIC_RELEASE);
+                *inserted = 1;
+                return n;
+            }
+
+            if (key == &__tombstone)
+                break;
+
+            if (0 == h->compare(k, key))
+            {
+                __lf_val(n);
+                *inserted = 0;
+                return n;
+            }
+        }
+    }
+}
+
+/**
+ * Get this key's value without taking a lock.
+ * @return key's item, otherwise NULL */
+static void *__lf_get(
+    hashmapq_t * h,
+    const void *key,
+    unsigned long hash
+)
+{
+    lf_table_t *t;
+
+    t = __atomic_load_n((lf_table_t **) &h->table, __ATOMIC_ACQUIRE);
+    for (; t; t = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE))
+    {
+        unsigned int i;
+
+        for (i = 0; i < __probe_span(t->size); i++)
+        {
+            hash_node_t *n = &t->array[__probe(t->size, hash, i)];
+            void *k = __atomic_load_n(&n->key, __ATOMIC_ACQUIRE);
+
+            if (!k)
+                return NULL;
+            if (k == &__tombstone)
+                break;
+            if (0 == h->compare(key, k))
+                return __lf_val(n);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Associate key with val without taking a lock.
+ * @return the existing val if key was already there; otherwise NULL */
+static void *__lf_put(
+    hashmapq_t * h,
+    void *k,
+    void *v,
+    unsigned long hash
+)
+{
+    hash_node_t *n;
+    int inserted;
+
+    n = __lf_insert(h, __atomic_load_n((lf_table_t **) &h->table,
+                                       __ATOMIC_ACQUIRE),
+                    k, v, hash, &inserted);
+    if (!inserted)
+        return __atomic_load_n(&n->val, __ATOMIC_ACQUIRE);
+
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/**
+ * Finish any migrations and point h->array at the newest array.
+ * Only safe once no other thread is using h. */
+static void __lf_settle(
+    hashmapq_t * h
+)
+{
+    lf_table_t *t;
+
+    for (t = h->table; t->next; t = h->table)
+    {
+        while (t->migrate_claim < t->size)
+            __lf_help(h, t);
+        __lf_advance(h);
+    }
+
+    h->array = t->array;
+    h->size = t->size;
+}
+
+/**
+ * Free every array, oldest first. */
+static void __lf_free_tables(
+    hashmapq_t * h
+)
+{
+    lf_table_t *t = h->tables;
+
+    while (t)
+    {
+        lf_table_t *next = t->next;
+
+        __free(h, t);
+        t = next;
+    }
+
+    h->tables = NULL;
+    h->table = NULL;
+    h->array = NULL;
+}
+
+/**
+ * Move up to nslots slots of the old array into the current one.
+ * Frees the old array once everything has been moved. */
+static void __migrate(
+    hashmapq_t * h,
+    int nslots
+)
+{
+    if (!h->array_old)
+        return;
+
+    for (; 0 < nslots && h->migrate_cur < h->size_old;
+         nslots--, h->migrate_cur++)
+    {
+        hash_node_t *n;
+        
+        n = &((hash_node_t *) h->array_old)[h->migrate_cur];
+
+        if (!n->key || n->key == &__tombstone)
+            continue;
+
+        h->count--;
+        __put(h, n->key, n->val, h->hashes_old ?
+              h->hashes_old[h->migrate_cur] : __hash(h, n->key));
+
+        /* leave a tombstone so the old array's probe chains stay intact.
+         * Concurrent readers keep using the old array untouched until the
+         * new one is published */
+        if (!(h->flags & HASHMAPQ_CONCURRENT_READS))
+            n->key = &__tombstone;
+    }
+
+    if (h->migrate_cur < h->size_old)
+        return;
+
+    if (h->flags & HASHMAPQ_CONCURRENT_READS)
+        __publish(h);
+
+    __free(h, h->array_old);
+    __free(h, h->hashes_old);
+    h->array_old = NULL;
+    h->hashes_old = NULL;
+    h->size_old = 0;
+}
+
+/**
+ * Swap in a doubled array. Entries stay in the old array until migrated. */
+static void __start_resize(
+    hashmapq_t * h,
+    int new_size
+)
+{
+    assert(!h->array_old);
+
+    h->array_old = h->array;
+    h->hashes_old = h->hashes;
+    h->size_old = h->size;
+    h->migrate_cur = 0;
+
+    h->slots_used = 0;
+    h->size = new_size;
+    h->array = __calloc(h, h->size, sizeof(hash_node_t));
+    if (h->hashes_old)
+        h->hashes = __calloc(h, h->size, sizeof(unsigned int));
+    __tracking_reset(h);
+}
+
+hashmapq_t *hashmapq_new(
+    func_longhash_f hash,
+    func_longcmp_f cmp,
+    unsigned int initial_capacity
+)
+{
+    return hashmapq_new_with_flags(hash, cmp, initial_capacity, 0);
+}
+
+hashmapq_t *hashmapq_new_with_flags(
+    func_longhash_f hash,
+    func_longcmp_f cmp,
+    unsigned int initial_capacity,
+    int flags
+)
+{
+    return hashmapq_new_with_allocator(hash, cmp, initial_capacity, flags,
+                                       NULL);
+}
+
+/**
+ * @return how full we let the array get by default */
+static float __spaceratio(
+    int flags
+)
+{
+    return flags & HASHMAPQ_ROBIN_HOOD ? ROBIN_HOOD_SPACERATIO : SPACERATIO;
+}
+
+/**
+ * Check flags make sense together, and add the ones they imply.
+ * @return flags to use */
+static int __check_flags(
+    func_longhash_f hash,
+    int flags
+)
+{
+    /* backward shifts would break the migration cursor */
+    assert(!((flags & HASHMAPQ_ROBIN_HOOD) &&
+             (flags & HASHMAPQ_INCREMENTAL_RESIZE)));
+
+    /* readers must never see entries move, or tables change under them */
+    assert(!((flags & HASHMAPQ_CONCURRENT_READS) &&
+             (flags & (HASHMAPQ_ROBIN_HOOD | HASHMAPQ_INCREMENTAL_RESIZE))));
+
+    /* lock-free arrays only ever hold a key and its val */
+    assert(!((flags & HASHMAPQ_LOCK_FREE) &&
+             ((flags & ~HASHMAPQ_LOCK_FREE) || !hash)));
+
+    /* a fixed array can't be swapped for another */
+    assert(!((flags & HASHMAPQ_FIXED) &&
+             (flags & (HASHMAPQ_INCREMENTAL_RESIZE |
+                       HASHMAPQ_CONCURRENT_READS | HASHMAPQ_LOCK_FREE))));
+
+    /* those maps clear by swapping arrays, or can't allocate to track or
+     * shrink */
+    assert(!((flags & (HASHMAPQ_FAST_CLEAR | HASHMAPQ_SHRINK_ON_CLEAR |
+                       HASHMAPQ_OCCUPANCY_BITMAP)) &&
+             (flags & (HASHMAPQ_CONCURRENT_READS | HASHMAPQ_LOCK_FREE |
+                       HASHMAPQ_FIXED))));
+
+    /* Robin Hood needs every entry's hash to know its probe distance, and
+     * without a hash callback stored hashes are all we have to rehash with */
+    if ((flags & HASHMAPQ_ROBIN_HOOD) || !hash)
+        flags |= HASHMAPQ_STORE_HASH;
+
+    return flags;
+}
+
+hashmapq_t *hashmapq_new_with_allocator(
+    func_longhash_f hash,
+    func_longcmp_f cmp,
+    unsigned int initial_capacity,
+    int flags,
+    const hashmapq_allocator_t * allocator
+)
+{
+    hashmapq_t *h;
+
+    assert(is_power_of_two(initial_capacity));
+    assert(!(flags & (HASHMAPQ_FIXED | HASHMAPQ_MAPPED)));
+
+    flags = __check_flags(hash, flags);
+    if (!allocator)
+        allocator = &__default_allocator;
+
+    h = allocator->alloc(sizeof(hashmapq_t), allocator->udata);
+    memset(h, 0, sizeof(hashmapq_t));
+    h->allocator = *allocator;
+    h->size = initial_capacity;
+    h->hash = hash;
+    h->compare = cmp;
+    h->flags = flags;
+    h->max_load = __spaceratio(flags);
+    if (flags & HASHMAPQ_LOCK_FREE)
+    {
+        h->table = h->tables = __lf_table_new(h, h->size);
+        h->array = ((lf_table_t *) h->table)->array;
+        return h;
+    }
+    h->array = __calloc(h, h->size, sizeof(hash_node_t));
+    if (flags & HASHMAPQ_STORE_HASH)
+        h->hashes = __calloc(h, h->size, sizeof(unsigned int));
+    if (flags & HASHMAPQ_CONCURRENT_READS)
+    {
+        h->readers = __calloc(h, READER_SHARDS, sizeof(reader_shard_t));
+        __publish(h);
+    }
+    __tracking_reset(h);
+    h->initial_size = h->size;
+    return h;
+}
+
+hashmapq_t *hashmapq_new_with_load_factors(
+    func_longhash_f hash,
+    func_longcmp_f cmp,
+    unsigned int initial_capacity,
+    int flags,
+    float max_load,
+    float min_load
+)
+{
+    hashmapq_t *h;
+
+    /* lock-free arrays are sized by the threads that fill them */
+    assert(!(flags & HASHMAPQ_LOCK_FREE));
+    assert(0 < max_load && max_load < 1);
+    /* quadratic probe chains get long past 3/4 full; only Robin Hood's
+     * linear probing is built for more */
+    assert((flags & HASHMAPQ_ROBIN_HOOD) || max_load <= 0.75);
+    /* a halved array must still be under the max, or we'd grow straight
+     * back */
+    assert(0 <= min_load && min_load * 2 < max_load);
+
+    h = hashmapq_new_with_flags(hash, cmp, initial_capacity, flags);
+    h->max_load = max_load;
+    h->min_load = min_load;
+    return h;
+}
+
+/**
+ * A fixed map's buffer holds its array, then its cached hashes, then the
+ * bitmap used when rehashing in place.
+ * @return bytes used by each part of the buffer */
+static void __buffer_layout(
+    unsigned int capacity,
+    int flags,
+    size_t *array,
+    size_t *hashes,
+    size_t *pending
+)
+{
+    *array = capacity * sizeof(hash_node_t);
+    *hashes = flags & HASHMAPQ_STORE_HASH ? capacity * sizeof(unsigned int) : 0;
+    *pending = capacity / 8 + 1;
+}
+
+size_t hashmapq_buffer_size(
+    unsigned int capacity,
+    int flags
+)
+{
+    size_t array, hashes, pending;
+
+    if (flags & HASHMAPQ_ROBIN_HOOD)
+        flags |= HASHMAPQ_STORE_HASH;
+    __buffer_layout(capacity, flags, &array, &hashes, &pending);
+    return array + hashes + pending;
+}
+
+void hashmapq_init_in_buffer(
+    hashmapq_t * h,
+    func_longhash_f hash,
+    func_longcmp_f cmp,
+    unsigned int capacity,
+    int flags,
+    void *buffer
+)
+{
+    size_t array, hashes, pending;
+
+    assert(is_power_of_two(capacity));
+    assert(hash || (flags & HASHMAPQ_STORE_HASH));
+
+    flags = __check_flags(hash, flags | HASHMAPQ_FIXED);
+    __buffer_layout(capacity, flags, &array, &hashes, &pending);
+    memset(buffer, 0, array + hashes + pending);
+
+    memset(h, 0, sizeof(hashmapq_t));
+    h->allocator = __no_allocator;
+    h->size = capacity;
+    h->hash = hash;
+    h->compare = cmp;
+    h->flags = flags;
+    h->max_load = __spaceratio(flags);
+    h->array = buffer;
+    if (flags & HASHMAPQ_STORE_HASH)
+        h->hashes = (unsigned int *) ((char *) buffer + array);
+}
+
+/**
+ * @return number of items within hash */
+int hashmapq_count(const hashmapq_t * h)
+{
+    return h->count;
+}
+
+/**
+ * @return size of the array used within hash */
+int hashmapq_size(
+    hashmapq_t * h
+)
+{
+    if (h->flags & HASHMAPQ_LOCK_FREE)
+        return ((lf_table_t *) __atomic_load_n((lf_table_t **) &h->table,
+                                               __ATOMIC_ACQUIRE))->size;
+    return h->size;
+}
+
+/* Snapshot files are a header, the slot array, the cached hashes, then the
+ * bytes of keys and vals. A slot holds its key and val as offsets from the
+ * start of the file when they were written as bytes, otherwise as the
+ * pointer values themselves */
+#define SNAPSHOT_MAGIC "HASHMAPQ"
+#define SNAPSHOT_VERSION 1
+/* reads back differently on a machine of the other byte order */
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+/* header flags, next to HASHMAPQ_ROBIN_HOOD and HASHMAPQ_MIX_HASH */
+#define SNAPSHOT_KEY_BYTES (1u << 30)
+#define SNAPSHOT_VAL_BYTES (1u << 31)
+/* the bytes of keys and vals are written out in runs this big */
+#define SNAPSHOT_WRITE_BUF (1 << 20)
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t flags;
+    /* longest probe sequence a get needs to follow */
+    uint32_t max_probe;
+    uint64_t size;
+    uint64_t count;
+    uint64_t array_off;
+    uint64_t hashes_off;
+    uint64_t data_off;
+    uint64_t len;
+    /* checksums of the slot array, the hashes and the bytes */
+    uint64_t array_sum;
+    uint64_t hashes_sum;
+    uint64_t data_sum;
+    /* checksum of the header up to here */
+    uint64_t header_sum;
+} snapshot_header_t;
+
+typedef struct
+{
+    uint64_t key;
+    uint64_t val;
+} snapshot_slot_t;
+
+/* save buffers the bytes of keys and vals here on their way to the file */
+typedef struct
+{
+    int fd;
+    /* where buf goes in the file */
+    uint64_t off;
+    char *buf;
+    size_t len;
+    uint64_t sum;
+    int err;
+} snapshot_writer_t;
+
+/**
+ * Checksum 8 bytes at a time; len is a multiple of 8 except at the very
+ * end, so sums over consecutive runs can be chained.
+ * @return sum updated with these bytes */
+static uint64_t __checksum(
+    const void *p,
+    size_t len,
+    uint64_t sum
+)
+{
+    const unsigned char *b = p;
+
+    for (; 8 <= len; len -= 8, b += 8)
+    {
+        uint64_t w;
+
+        memcpy(&w, b, 8);
+        sum = (sum ^ w) * 0x100000001b3ull;
+        sum ^= sum >> 29;
+    }
+
+    for (; len; len--, b++)
+        sum = (sum ^ *b) * 0x100000001b3ull;
+
+    return sum;
+}
+
+/**
+ * @return 0 once all of p is written at off, otherwise -1 */
+static int __pwrite_all(
+    int fd,
+    const void *p,
+    size_t len,
+    uint64_t off
+)
+{
+    const char *b = p;
+
+    while (len)
+    {
+        ssize_t n = pwrite(fd, b, len, off);
+
+        if (-1 == n)
+        {
+            if (EINTR == errno)
+                continue;
+            return -1;
+        }
+        b += n;
+        len -= n;
+        off += n;
+    }
+
+    return 0;
+}
+
+static void __writer_flush(
+    snapshot_writer_t * w
+)
+{
+    if (!w->err && __pwrite_all(w->fd, w->buf, w->len, w->off))
+        w->err = 1;
+    w->off += w->len;
+    w->len = 0;
+}
+
+/**
+ * Append an item's bytes to the file, padded to 8 bytes.
+ * @return offset of the bytes in the file */
+static uint64_t __writer_item(
+    hashmapq_t * h,
+    snapshot_writer_t * w,
+    func_serialize_f serialize,
+    const void *item
+)
+{
+    size_t need = serialize(item, w->buf + w->len, SNAPSHOT_WRITE_BUF - w->len);
+    size_t padded = (need + 7) & ~(size_t) 7;
+    uint64_t off;
+
+    if (SNAPSHOT_WRITE_BUF - w->len < padded)
+    {
+        __writer_flush(w);
+
+        /* too big to buffer; write it straight out */
+        if (SNAPSHOT_WRITE_BUF < padded)
+        {
+            char *big = __calloc(h, padded, 1);
+
+            serialize(item, big, padded);
+            w->sum = __checksum(big, padded, w->sum);
+            if (!w->err && __pwrite_all(w->fd, big, padded, w->off))
+                w->err = 1;
+            __free(h, big);
+            off = w->off;
+            w->off += padded;
+            return off;
+        }
+
+        serialize(item, w->buf, SNAPSHOT_WRITE_BUF);
+    }
+
+    memset(w->buf + w->len + need, 0, padded - need);
+    w->sum = __checksum(w->buf + w->len, padded, w->sum);
+    off = w->off + w->len;
+    w->len += padded;
+    return off;
+}
+
+int hashmapq_save(
+    hashmapq_t * h,
+    int fd,
+    func_serialize_f key_serializer,
+    func_serialize_f val_serializer
+)
+{
+    snapshot_header_t hd;
+    snapshot_slot_t *slots;
+    uint32_t *hashes;
+    snapshot_writer_t w;
+    size_t hashes_len;
+    int ii, err;
+
+    assert(!(h->flags & HASHMAPQ_MAPPED) && !h->seeded_hash);
+
+    if (h->array_old)
+        __migrate(h, h->size_old);
+    if (h->flags & HASHMAPQ_LOCK_FREE)
+        __lf_settle(h);
+
+    memset(&hd, 0, sizeof(hd));
+    memcpy(hd.magic, SNAPSHOT_MAGIC, sizeof(hd.magic));
+    hd.version = SNAPSHOT_VERSION;
+    hd.byte_order = SNAPSHOT_BYTE_ORDER;
+    hd.flags = (h->flags & (HASHMAPQ_ROBIN_HOOD | HASHMAPQ_MIX_HASH)) |
+        (key_serializer ? SNAPSHOT_KEY_BYTES : 0) |
+        (val_serializer ? SNAPSHOT_VAL_BYTES : 0);
+    hd.size = h->size;
+    hd.count = h->count;
+    hashes_len = (h->size * sizeof(uint32_t) + 7) & ~(size_t) 7;
+    hd.array_off = sizeof(hd);
+    hd.hashes_off = hd.array_off + h->size * sizeof(snapshot_slot_t);
+    hd.data_off = hd.hashes_off + hashes_len;
+
+    slots = __calloc(h, h->size, sizeof(snapshot_slot_t));
+    hashes = __calloc(h, hashes_len, 1);
+    memset(&w, 0, sizeof(w));
+    w.fd = fd;
+    w.off = hd.data_off;
+    w.buf = __calloc(h, SNAPSHOT_WRITE_BUF, 1);
+
+    for (ii = 0; ii < h->size; ii++)
+    {
+        hash_node_t *n = __node(h, ii);
+        unsigned long hash;
+        unsigned int idx, i;
+
+        if (!n->key || n->key == &__tombstone)
+            continue;
+
+        hash = h->hashes ? h->hashes[ii] : __hash(h, n->key);
+
+        /* Robin Hood arrays have no tombstones and are kept as they are.
+         * Everything else is placed afresh, leaving the tombstones out */
+        if (h->flags & HASHMAPQ_ROBIN_HOOD)
+        {
+            idx = ii;
+            i = (ii - hash) & (h->size - 1);
+        }
+        else
+            for (i = 0; slots[idx = __probe(h->size, hash, i)].key; i++)
+                ;
+
+        if (hd.max_probe < i)
+            hd.max_probe = i;
+
+        slots[idx].key = key_serializer ?
+            __writer_item(h, &w, key_serializer, n->key) :
+            (uint64_t) (uintptr_t) n->key;
+        slots[idx].val = val_serializer ?
+            __writer_item(h, &w, val_serializer, n->val) :
+            (uint64_t) (uintptr_t) n->val;
+        hashes[idx] = (uint32_t) hash;
+    }
+
+    __writer_flush(&w);
+    hd.len = w.off;
+    hd.array_sum = __checksum(slots, h->size * sizeof(snapshot_slot_t), 0);
+    hd.hashes_sum = __checksum(hashes, hashes_len, 0);
+    hd.data_sum = w.sum;
+    hd.header_sum = __checksum(&hd, offsetof(snapshot_header_t, header_sum), 0);
+
+    /* the header goes last, so a half-written file is never taken as whole */
+    err = w.err ||
+        __pwrite_all(fd, slots, h->size * sizeof(snapshot_slot_t),
+                     hd.array_off) ||
+        __pwrite_all(fd, hashes, hashes_len, hd.hashes_off) ||
+        __pwrite_all(fd, &hd, sizeof(hd), 0) ||
+        ftruncate(fd, hd.len);
+
+    __free(h, slots);
+    __free(h, hashes);
+    __free(h, w.buf);
+    return err ? -1 : 0;
+}
+
+/**
+ * @return 1 if the header describes a file of len bytes we can read */
+static int __snapshot_header_ok(
+    const snapshot_header_t * hd,
+    uint64_t len
+)
+{
+    return 0 == memcmp(hd->magic, SNAPSHOT_MAGIC, sizeof(hd->magic)) &&
+        SNAPSHOT_VERSION == hd->version &&
+        SNAPSHOT_BYTE_ORDER == hd->byte_order &&
+        hd->header_sum ==
+        __checksum(hd, offsetof(snapshot_header_t, header_sum), 0) &&
+        hd->len == len &&
+        0 < hd->size && hd->size <= (1u << 30) &&
+        hd->size <= len / sizeof(snapshot_slot_t) &&
+        is_power_of_two(hd->size) && hd->count < hd->size &&
+        hd->max_probe < hd->size * 2 &&
+        hd->array_off == sizeof(snapshot_header_t) &&
+        hd->hashes_off == hd->array_off + hd->size * sizeof(snapshot_slot_t) &&
+        hd->data_off == hd->hashes_off +
+        ((hd->size * sizeof(uint32_t) + 7) & ~(uint64_t) 7) &&
+        hd->data_off <= len;
+}
+
+hashmapq_t *hashmapq_open_mmap(
+    const char *path,
+    func_longhash_f hash,
+    func_longcmp_f cmp
+)
+{
+    const snapshot_header_t *hd;
+    struct stat st;
+    hashmapq_t *h;
+    char *base;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (-1 == fd)
+        return NULL;
+
+    if (-1 == fstat(fd, &st) || st.st_size < (off_t) sizeof(snapshot_header_t))
+    {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == base)
+        return NULL;
+
+    hd = (const snapshot_header_t *) base;
+    if (!__snapshot_header_ok(hd, st.st_size))
+    {
+        munmap(base, st.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    /* gets jump all over the file; reading ahead only wastes the cache */
+    madvise(base, st.st_size, MADV_RANDOM);
+
+    h = __default_allocator.alloc(sizeof(hashmapq_t), NULL);
+    memset(h, 0, sizeof(hashmapq_t));
+    h->allocator = __default_allocator;
+    h->size = hd->size;
+    h->count = h->slots_used = hd->count;
+    h->array = base + hd->array_off;
+    h->hashes = (unsigned int *) (base + hd->hashes_off);
+    h->hash = hash;
+    h->compare = cmp;
+    h->flags = HASHMAPQ_MAPPED | HASHMAPQ_STORE_HASH |
+        (hd->flags & (HASHMAPQ_ROBIN_HOOD | HASHMAPQ_MIX_HASH));
+    h->max_load = __spaceratio(h->flags);
+    h->initial_size = h->size;
+    h->mapping = base;
+    return h;
+}
+
+int hashmapq_verify_mmap(
+    const hashmapq_t * h
+)
+{
+    const snapshot_header_t *hd = h->mapping;
+    const char *base = h->mapping;
+
+    assert(h->flags & HASHMAPQ_MAPPED);
+
+    return hd->array_sum == __checksum(base + hd->array_off,
+                                       hd->size * sizeof(snapshot_slot_t), 0) &&
+        hd->hashes_sum == __checksum(base + hd->hashes_off,
+                                     hd->data_off - hd->hashes_off, 0) &&
+        hd->data_sum == __checksum(base + hd->data_off,
+                                   hd->len - hd->data_off, 0);
+}
+
+/**
+ * Look key up in a snapshot file, straight out of the mapping. */
+static void *__mapped_get(
+    hashmapq_t * h,
+    const void *key,
+    unsigned long hash
+)
+{
+    const snapshot_header_t *hd = h->mapping;
+    const snapshot_slot_t *slots = h->array;
+    const char *base = h->mapping;
+    unsigned int i;
+
+    for (i = 0; i <= hd->max_probe; i++)
+    {
+        unsigned int idx = h->flags & HASHMAPQ_ROBIN_HOOD ?
+            (hash + i) & (h->size - 1) : __probe(h->size, hash, i);
+        const snapshot_slot_t *s = &slots[idx];
+        void *k;
+
+        if (!s->key)
+            return NULL;
+        if (h->hashes[idx] != (unsigned int) hash)
+            continue;
+
+        k = hd->flags & SNAPSHOT_KEY_BYTES ?
+            (void *) (base + s->key) : (void *) (uintptr_t) s->key;
+        if (0 == h->compare(key, k))
+            return hd->flags & SNAPSHOT_VAL_BYTES ?
+                (void *) (base + s->val) : (void *) (uintptr_t) s->val;
+    }
+
+    return NULL;
+}
+
+/* Journal and checkpoint files are runs of records. A put carries its key
+ * and val, a remove its key. A checkpoint is page records closed by an end
+ * record, and a full one opens with a full record. Recovery takes the pages
+ * of the last complete checkpoint and replays the journal over them */
+enum
+{
+    JOURNAL_PUT = 1,
+    JOURNAL_REMOVE,
+    JOURNAL_CLEAR,
+    CHECKPOINT_FULL,
+    CHECKPOINT_PAGE,
+    CHECKPOINT_END,
+};
+
+typedef struct
+{
+    uint32_t type;
+    /* of a page record, which page; of a full record, how many pages */
+    uint32_t page;
+    /* bytes that follow the record */
+    uint64_t len;
+    /* checksum of those bytes and the fields above */
+    uint64_t sum;
+} journal_record_t;
+
+/**
+ * @return 0 once all of p is written, otherwise -1 */
+static int __write_all(
+    int fd,
+    const void *p,
+    size_t len
+)
+{
+    const char *b = p;
+
+    while (len)
+    {
+        ssize_t n = write(fd, b, len);
+
+        if (-1 == n)
+        {
+            if (EINTR == errno)
+                continue;
+            return -1;
+        }
+        b += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/**
+ * Make room for n more bytes.
+ * @return where they go */
+static char *__bytes_reserve(
+    hashmapq_t * h,
+    bytes_t * b,
+    size_t n
+)
+{
+    if (b->cap - b->len < n)
+    {
+        size_t cap = b->cap ? b->cap : 256;
+        char *p;
+
+        while (cap - b->len < n)
+            cap *= 2;
+        p = __calloc(h, cap, 1);
+        if (b->len)
+            memcpy(p, b->p, b->len);
+        __free(h, b->p);
+        b->p = p;
+        b->cap = cap;
+    }
+
+    return b->p + b->len;
+}
+
+/**
+ * Append an item's bytes, or without a serializer the pointer value itself.
+ * @return bytes appended */
+static uint32_t __bytes_item(
+    hashmapq_t * h,
+    bytes_t * b,
+    func_serialize_f serialize,
+    const void *item
+)
+{
+    size_t need;
+
+    if (!serialize)
+    {
+        memcpy(__bytes_reserve(h, b, sizeof(item)), &item, sizeof(item));
+        b->len += sizeof(item);
+        return sizeof(item);
+    }
+
+    need = serialize(item, __bytes_reserve(h, b, 64), b->cap - b->len);
+    if (b->cap - b->len < need)
+        serialize(item, __bytes_reserve(h, b, need), need);
+    b->len += need;
+    return need;
+}
+
+/**
+ * Append a key and val as their lengths followed by their bytes. */
+static void __bytes_entry(
+    hashmapq_t * h,
+    bytes_t * b,
+    const journal_t * j,
+    const void *k,
+    const void *v,
+    int has_val
+)
+{
+    size_t at = b->len;
+    uint32_t lens[2];
+
+    __bytes_reserve(h, b, sizeof(lens));
+    b->len += sizeof(lens);
+    lens[0] = __bytes_item(h, b, j->key_serializer, k);
+    lens[1] = has_val ? __bytes_item(h, b, j->val_serializer, v) : 0;
+    memcpy(b->p + at, lens, sizeof(lens));
+}
+
+static uint64_t __record_sum(
+    const journal_record_t * r,
+    const void *payload
+)
+{
+    return __checksum(payload, r->len,
+                      ((uint64_t) r->type << 32 | r->page) ^ r->len);
+}
+
+/**
+ * Start a record. Its payload is appended after it.
+ * @return where the record starts, for __bytes_end_record() */
+static size_t __bytes_record(
+    hashmapq_t * h,
+    bytes_t * b,
+    uint32_t type,
+    uint32_t page
+)
+{
+    journal_record_t r;
+    size_t at = b->len;
+
+    memset(&r, 0, sizeof(r));
+    r.type = type;
+    r.page = page;
+    memcpy(__bytes_reserve(h, b, sizeof(r)), &r, sizeof(r));
+    b->len += sizeof(r);
+    return at;
+}
+
+/**
+ * Seal the record started at at with its payload's length and checksum. */
+static void __bytes_end_record(
+    bytes_t * b,
+    size_t at
+)
+{
+    journal_record_t r;
+
+    memcpy(&r, b->p + at, sizeof(r));
+    r.len = b->len - at - sizeof(r);
+    r.sum = __record_sum(&r, b->p + at + sizeof(r));
+    memcpy(b->p + at, &r, sizeof(r));
+}
+
+static void __journal_flush(
+    hashmapq_t * h
+)
+{
+    journal_t *j = h->journal;
+
+    if (!j->err && __write_all(j->fd, j->buf.p, j->buf.len))
+        j->err = 1;
+    j->buf.len = 0;
+}
+
+static void __journal_append(
+    hashmapq_t * h,
+    uint32_t type,
+    const void *k,
+    const void *v
+)
+{
+    journal_t *j = h->journal;
+    size_t at = __bytes_record(h, &j->buf, type, 0);
+
+    if (JOURNAL_CLEAR != type)
+        __bytes_entry(h, &j->buf, j, k, v, JOURNAL_PUT == type);
+    __bytes_end_record(&j->buf, at);
+
+    if (JOURNAL_BUF <= j->buf.len)
+        __journal_flush(h);
+}
+
+static void __journal_put(
+    hashmapq_t * h,
+    void *k,
+    void *v
+)
+{
+    __journal_append(h, JOURNAL_PUT, k, v);
+}
+
+static void __journal_remove(
+    hashmapq_t * h,
+    const void *k
+)
+{
+    __journal_append(h, JOURNAL_REMOVE, k, NULL);
+}
+
+static void __journal_clear(
+    hashmapq_t * h
+)
+{
+    __journal_append(h, JOURNAL_CLEAR, NULL, NULL);
+    ((journal_t *) h->journal)->full = 1;
+}
+
+void hashmapq_journal_start(
+    hashmapq_t * h,
+    int journal_fd,
+    int checkpoint_fd,
+    func_serialize_f key_serializer,
+    func_serialize_f val_serializer
+)
+{
+    journal_t *j;
+
+    assert(!h->journal);
+    assert(!(h->flags & (HASHMAPQ_LOCK_FREE | HASHMAPQ_FIXED |
+                         HASHMAPQ_MAPPED)));
+
+    j = __calloc(h, 1, sizeof(journal_t));
+    j->fd = journal_fd;
+    j->checkpoint_fd = checkpoint_fd;
+    j->key_serializer = key_serializer;
+    j->val_serializer = val_serializer;
+    j->pages = __calloc(h, __journal_npages(h->size) / 8 + 1, 1);
+    /* there is nothing yet for an incremental checkpoint to build on */
+    j->full = 1;
+    h->journal = j;
+}
+
+int hashmapq_journal_commit(
+    hashmapq_t * h
+)
+{
+    journal_t *j = h->journal;
+
+    __journal_flush(h);
+    if (!j->err && fdatasync(j->fd))
+        j->err = 1;
+    return j->err ? -1 : 0;
+}
+
+int hashmapq_journal_stop(
+    hashmapq_t * h
+)
+{
+    journal_t *j = h->journal;
+    int err = hashmapq_journal_commit(h);
+
+    __free(h, j->buf.p);
+    __free(h, j->pages);
+    __free(h, j);
+    h->journal = NULL;
+    return err;
+}
+
+int hashmapq_checkpoint(
+    hashmapq_t * h
+)
+{
+    journal_t *j = h->journal;
+    bytes_t out = { NULL, 0, 0 };
+    int page, npages, err = 0;
+    off_t start;
+
+    /* pages only cover the current array */
+    if (h->array_old)
+        __migrate(h, h->size_old);
+
+    start = lseek(j->checkpoint_fd, 0, SEEK_END);
+    npages = __journal_npages(h->size);
+
+    if (j->full)
+        __bytes_end_record(&out, __bytes_record(h, &out, CHECKPOINT_FULL,
+                                                npages));
+
+    for (page = 0; page < npages; page++)
+    {
+        int ii, end = (page + 1) * JOURNAL_PAGE_SLOTS;
+        size_t at;
+
+        if (!j->full && !(j->pages[page / 8] & (1 << (page % 8))))
+            continue;
+
+        at = __bytes_record(h, &out, CHECKPOINT_PAGE, page);
+        for (ii = page * JOURNAL_PAGE_SLOTS; ii < end && ii < h->size; ii++)
+        {
+            hash_node_t *n = __node(h, ii);
+
+            if (n->key && n->key != &__tombstone)
+                __bytes_entry(h, &out, j, n->key, n->val, 1);
+        }
+        __bytes_end_record(&out, at);
+
+        if (JOURNAL_BUF <= out.len)
+        {
+            err = err || __write_all(j->checkpoint_fd, out.p, out.len);
+            out.len = 0;
+        }
+    }
+
+    __bytes_end_record(&out, __bytes_record(h, &out, CHECKPOINT_END, 0));
+    err = err || -1 == start ||
+        __write_all(j->checkpoint_fd, out.p, out.len) ||
+        fdatasync(j->checkpoint_fd);
+    __free(h, out.p);
+
+    if (err)
+    {
+        /* later checkpoints have to follow a complete one. Should this
+         * fail too, the torn tail lacks an end record, so recovery stops
+         * short of it anyway */
+        if (-1 != start)
+            err = ftruncate(j->checkpoint_fd, start);
+        return -1;
+    }
+
+    memset(j->pages, 0, npages / 8 + 1);
+    j->full = 0;
+
+    /* everything journaled so far is in the checkpoint */
+    j->buf.len = 0;
+    j->err = ftruncate(j->fd, 0) || -1 == lseek(j->fd, 0, SEEK_SET) ||
+        fdatasync(j->fd);
+    return j->err ? -1 : 0;
+}
+
+/**
+ * Map a whole file for reading.
+ * @return its bytes, or NULL if it is empty or can't be mapped */
+static const char *__map_file(
+    int fd,
+    size_t *len
+)
+{
+    struct stat st;
+    void *p;
+
+    *len = 0;
+    if (-1 == fstat(fd, &st) || 0 == st.st_size)
+        return NULL;
+
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (MAP_FAILED == p)
+        return NULL;
+
+    *len = st.st_size;
+    return p;
+}
+
+/**
+ * @return payload of the record at pos if it is whole and intact,
+ *  otherwise NULL */
+static const char *__read_record(
+    const char *base,
+    size_t len,
+    size_t pos,
+    journal_record_t * r
+)
+{
+    if (!base || len - pos < sizeof(*r))
+        return NULL;
+
+    memcpy(r, base + pos, sizeof(*r));
+    if (len - pos - sizeof(*r) < r->len ||
+        r->sum != __record_sum(r, base + pos + sizeof(*r)))
+        return NULL;
+
+    return base + pos + sizeof(*r);
+}
+
+static void *__read_item(
+    const char *p,
+    size_t len,
+    void *(*deserialize) (const void *, size_t)
+)
+{
+    void *item = NULL;
+
+    if (deserialize)
+        return deserialize(p, len);
+    memcpy(&item, p, len < sizeof(item) ? len : sizeof(item));
+    return item;
+}
+
+/**
+ * Read a key and val written by __bytes_entry().
+ * @return bytes the entry took, or 0 if it runs past end */
+static size_t __read_entry(
+    const char *p,
+    const char *end,
+    const hashmapq_deserializer_t * d,
+    void **k,
+    void **v
+)
+{
+    uint32_t lens[2];
+
+    if ((size_t) (end - p) < sizeof(lens))
+        return 0;
+    memcpy(lens, p, sizeof(lens));
+    if ((size_t) (end - p) - sizeof(lens) < (size_t) lens[0] + lens[1])
+        return 0;
+
+    p += sizeof(lens);
+    *k = __read_item(p, lens[0], d ? d->key : NULL);
+    *v = lens[1] ? __read_item(p + lens[0], lens[1], d ? d->val : NULL) : NULL;
+    return sizeof(lens) + lens[0] + lens[1];
+}
+
+static void __release(
+    const hashmapq_deserializer_t * d,
+    void *item
+)
+{
+    if (d && d->release && item)
+        d->release(item);
+}
+
+static int __release_entry(
+    void *k,
+    void *v,
+    void *udata
+)
+{
+    __release(udata, k);
+    __release(udata, v);
+    return 0;
+}
+
+/**
+ * Put while recovering; whatever the map doesn't keep is released. */
+static void __replay_put(
+    hashmapq_t * h,
+    const hashmapq_deserializer_t * d,
+    void *k,
+    void *v
+)
+{
+    int inserted;
+    void **val = hashmapq_get_or_put(h, k, v, &inserted);
+
+    if (val && inserted)
+        return;
+
+    /* the map already has its own copy of the key */
+    __release(d, k);
+    if (!val)
+    {
+        __release(d, v);
+        return;
+    }
+    __release(d, *val);
+    *val = v;
+}
+
+/**
+ * Replay the journal's records onto the map.
+ * @return where the last intact record ends */
+static size_t __replay_journal(
+    hashmapq_t * h,
+    const char *base,
+    size_t len,
+    const hashmapq_deserializer_t * d
+)
+{
+    journal_record_t r;
+    const char *payload;
+    size_t pos = 0;
+
+    while ((payload = __read_record(base, len, pos, &r)))
+    {
+        void *k, *v;
+
+        if (JOURNAL_CLEAR == r.type)
+        {
+            hashmapq_for_each(h, __release_entry, (void *) d);
+            hashmapq_clear(h);
+        }
+        else if ((JOURNAL_PUT != r.type && JOURNAL_REMOVE != r.type) ||
+                 !__read_entry(payload, payload + r.len, d, &k, &v))
+            break;
+        else if (JOURNAL_PUT == r.type)
+            __replay_put(h, d, k, v);
+        else
+        {
+            hash_entry_t e;
+
+            hashmapq_remove_entry(h, &e, k);
+            __release(d, e.key);
+            __release(d, e.val);
+            __release(d, k);
+        }
+
+        pos = payload - base + r.len;
+    }
+
+    return pos;
+}
+
+/**
+ * Put the entries of the last complete checkpoint into the map.
+ * @return where that checkpoint ends */
+static size_t __load_checkpoint(
+    hashmapq_t * h,
+    const char *base,
+    size_t len,
+    const hashmapq_deserializer_t * d
+)
+{
+    /* for each page, 1 + where its latest record is */
+    size_t *done = NULL, *pending = NULL;
+    int ndone = 0, npending = 0, ii;
+    journal_record_t r;
+    const char *payload;
+    size_t pos = 0, good = 0;
+
+    for (; (payload = __read_record(base, len, pos, &r));
+         pos = payload - base + r.len)
+    {
+        /* an incremental checkpoint starts from the last one */
+        if (!pending && CHECKPOINT_FULL != r.type)
+        {
+            if (!done)
+                break;
+            npending = ndone;
+            pending = __calloc(h, npending + 1, sizeof(size_t));
+            memcpy(pending, done, npending * sizeof(size_t));
+        }
+
+        if (CHECKPOINT_FULL == r.type)
+        {
+            __free(h, pending);
+            npending = r.page;
+            pending = __calloc(h, npending + 1, sizeof(size_t));
+        }
+        else if (CHECKPOINT_PAGE == r.type && r.page < (uint32_t) npending)
+            pending[r.page] = pos + 1;
+        else if (CHECKPOINT_END == r.type)
+        {
+            __free(h, done);
+            done = pending;
+            ndone = npending;
+            pending = NULL;
+            good = payload - base + r.len;
+        }
+        else
+            break;
+    }
+
+    for (ii = 0; ii < ndone; ii++)
+    {
+        const char *p, *end;
+        size_t n;
+
+        if (!done[ii])
+            continue;
+
+        memcpy(&r, base + done[ii] - 1, sizeof(r));
+        p = base + done[ii] - 1 + sizeof(r);
+        for (end = p + r.len; p < end; p += n)
+        {
+            void *k, *v;
+
+            if (!(n = __read_entry(p, end, d, &k, &v)))
+                break;
+            __replay_put(h, d, k, v);
+        }
+    }
+
+    __free(h, pending);
+    __free(h, done);
+    return good;
+}
+
+int hashmapq_recover(
+    hashmapq_t * h,
+    int journal_fd,
+    int checkpoint_fd,
+    const hashmapq_deserializer_t * d
+)
+{
+    const char *base;
+    size_t len, good;
+    int err = 0;
+
+    assert(0 == hashmapq_count(h) && !h->journal);
+
+    /* anything after the last intact record was cut short by a crash; cut
+     * it off so new records follow on from good ones */
+    base = __map_file(checkpoint_fd, &len);
+    good = __load_checkpoint(h, base, len, d);
+    if (base)
+        munmap((void *) base, len);
+    err |= good < len && ftruncate(checkpoint_fd, good);
+
+    base = __map_file(journal_fd, &len);
+    good = __replay_journal(h, base, len, d);
+    if (base)
+        munmap((void *) base, len);
+    err |= good < len && ftruncate(journal_fd, good);
+    err |= -1 == lseek(journal_fd, good, SEEK_SET);
+
+    return err ? -1 : 0;
+}
+
+/**
+ * Empty this hash. */
+static void __clear(
+    hashmapq_t * h
+)
+{
+    int ii;
+
+    if (h->flags & HASHMAPQ_LOCK_FREE)
+    {
+        __lf_settle(h);
+        __lf_free_tables(h);
+        h->table = h->tables = __lf_table_new(h, h->size);
+        h->array = ((lf_table_t *) h->table)->array;
+        h->count = 0;
+        return;
+    }
+
+    /* readers get a fresh array rather than watching this one empty out */
+    if (h->flags & HASHMAPQ_CONCURRENT_READS)
+    {
+        hash_node_t *array_old = h->array;
+        unsigned int *hashes_old = h->hashes;
+
+        h->array = __calloc(h, h->size, sizeof(hash_node_t));
+        if (hashes_old)
+            h->hashes = __calloc(h, h->size, sizeof(unsigned int));
+        h->count = 0;
+        h->slots_used = 0;
+        __publish(h);
+        __free(h, array_old);
+        __free(h, hashes_old);
+        return;
+    }
+
+    /* nothing in the old array is worth migrating now */
+    if (h->array_old)
+    {
+        for (ii = h->migrate_cur; ii < h->size_old; ii++)
+        {
+            hash_node_t *n;
+
+            n = &((hash_node_t *) h->array_old)[ii];
+
+            if (n->key && n->key != (void*)&__tombstone)
+                h->count--;
+        }
+
+        h->migrate_cur = h->size_old;
+        __migrate(h, 0);
+    }
+
+    /* only wipe the chunks that have been written to */
+    if (h->flags & HASHMAPQ_FAST_CLEAR)
+    {
+        for (ii = 0; ii < h->ndirty; ii++)
+        {
+            int c = h->dirty_list[ii], start = c * CLEAR_CHUNK;
+            int len = h->size - start < CLEAR_CHUNK ? h->size - start : CLEAR_CHUNK;
+
+            memset(__node(h, start), 0, len * sizeof(hash_node_t));
+            h->dirty[c / 8] &= ~(1 << (c % 8));
+            if (h->occupied)
+                h->occupied[c] = 0;
+        }
+
+        h->ndirty = 0;
+        h->count = 0;
+        h->slots_used = 0;
+        return;
+    }
+
+    for (ii = 0; ii < h->size; ii++)
+    {
+        hash_node_t *n;
+
+        n = &((hash_node_t *) h->array)[ii];
+
+        if (NULL == n->key)
+            continue;
+
+        if (n->key == (void*)&__tombstone)
+        {
+            n->key = NULL;
+            continue;
+        }
+
+        n->key = NULL;
+        h->count--;
+        assert(0 <= h->count);
+    }
+
+    if (h->occupied)
+        memset(h->occupied, 0,
+               __nchunks(h->size) * sizeof(unsigned long long));
+
+    h->slots_used = 0;
+    assert(0 == hashmapq_count(h));
+}
+
+/**
+ * Swap the empty array for a smaller one if the last SHRINK_CLEARS clears
+ * never got near filling it. */
+static void __shrink_after_clear(
+    hashmapq_t * h
+)
+{
+    int size = h->size;
+
+    if (++h->clears < SHRINK_CLEARS)
+        return;
+
+    /* keep at least twice the room the peak needed */
+    while (size / 2 >= h->initial_size &&
+           h->peak < (size / 2) * h->max_load / 2)
+        size /= 2;
+
+    h->clears = 0;
+    h->peak = 0;
+
+    if (size == h->size)
+        return;
+
+    __free(h, h->array);
+    __free(h, h->hashes);
+    h->size = size;
+    h->array = __calloc(h, h->size, sizeof(hash_node_t));
+    if (h->flags & HASHMAPQ_STORE_HASH)
+        h->hashes = __calloc(h, h->size, sizeof(unsigned int));
+    __tracking_reset(h);
+}
+
+void hashmapq_clear(
+    hashmapq_t * h
+)
+{
+    assert(!(h->flags & HASHMAPQ_MAPPED));
+
+    if (h->journal)
+        __journal_clear(h);
+
+    if (h->count > h->peak)
+        h->peak = h->count;
+
+    __clear(h);
+
+    if (h->flags & HASHMAPQ_SHRINK_ON_CLEAR)
+        __shrink_after_clear(h);
+}
+
+/**
+ * Free all the memory related to this hash. */
+void hashmapq_free(
+    hashmapq_t * h
+)
+{
+    assert(h);
+    if (h->flags & HASHMAPQ_MAPPED)
+    {
+        munmap(h->mapping, ((snapshot_header_t *) h->mapping)->len);
+        h->mapping = h->array = NULL;
+        h->hashes = NULL;
+        return;
+    }
+    if (h->journal)
+        hashmapq_journal_stop(h);
+    __clear(h);
+    if (h->flags & HASHMAPQ_LOCK_FREE)
+        __lf_free_tables(h);
+    __free(h, h->array);
+    __free(h, h->hashes);
+    __free(h, h->table);
+    __free(h, h->readers);
+    __free(h, h->dirty);
+    __free(h, h->dirty_list);
+    __free(h, h->occupied);
+    h->array = NULL;
+    h->hashes = NULL;
+    h->table = NULL;
+    h->readers = NULL;
+    h->dirty = NULL;
+    h->dirty_list = NULL;
+    h->occupied = NULL;
+}
+
+/**
+ * Free all the memory related to this hash.
+ * This includes the actual h itself. */
+void hashmapq_freeall(
+    hashmapq_t * h
+)
+{
+    hashmapq_allocator_t allocator;
+
+    assert(h);
+    hashmapq_free(h);
+    allocator = h->allocator;
+    allocator.free(h, allocator.udata);
+}
+
+/**
+ * Get this key's value, given the key's hash.
+ * @return key's item, otherwise NULL */
+static void *__get(
+    hashmapq_t * h,
+    const void *key,
+    unsigned long hash
+)
+{
+    int idx;
+
+    idx = __find(h, h->array, h->hashes, h->size, key, hash);
+    if (-1 != idx)
+        return __node(h, idx)->val;
+
+    if (h->array_old)
+    {
+        idx = __find(h, h->array_old, h->hashes_old, h->size_old, key, hash);
+        if (-1 != idx)
+            return ((hash_node_t *) h->array_old)[idx].val;
+    }
+
+    return NULL;
+}
+
+/**
+ * Get this key's value, given its hash as the map works with it. */
+static void *__get_hashed(
+    hashmapq_t * h,
+    const void *key,
+    unsigned long hash
+)
+{
+    if (key && (h->flags & HASHMAPQ_CONCURRENT_READS))
+        return __concurrent_get(h, key, hash);
+
+    if (key && (h->flags & HASHMAPQ_LOCK_FREE))
+        return __lf_get(h, key, hash);
+
+    if (key && (h->flags & HASHMAPQ_MAPPED))
+        return __mapped_get(h, key, hash);
+
+    if (0 == hashmapq_count(h) || !key)
+        return NULL;
+
+    __migrate(h, MIGRATE_SLOTS);
+
+    return __get(h, key, hash);
+}
+
+/**
+ * Get this key's value.
+ * @return key's item, otherwise NULL */
+void *hashmapq_get(
+    hashmapq_t * h,
+    const void *key
+)
+{
+    if (!key)
+        return NULL;
+
+    if (h->flags & HASHMAPQ_CONCURRENT_READS)
+        return __concurrent_get(h, key, __hash(h, key));
+
+    if (h->flags & HASHMAPQ_LOCK_FREE)
+        return __lf_get(h, key, __hash(h, key));
+
+    if (0 == hashmapq_count(h))
+        return NULL;
+
+    return __get_hashed(h, key, __hash(h, key));
+}
+
+void *hashmapq_get_with_hash(
+    hashmapq_t * h,
+    const void *key,
+    unsigned long hash
+)
+{
+    assert(!h->seeded_hash);
+    return __get_hashed(h, key, __mix(h, hash));
+}
+
+/**
+ * Pull in the first slot of this hash's probe sequence. */
+static void __prefetch(
+    const hashmapq_t * h,
+    unsigned long hash
+)
+{
+    unsigned int idx = __probe(h->size, hash, 0);
+
+    __builtin_prefetch(__node(h, idx));
+    if (h->hashes)
+        __builtin_prefetch(&h->hashes[idx]);
+}
+
+/**
+ * Pull in the key the first slot of this hash's probe sequence points to,
+ * since compare is going to read it. */
+static void __prefetch_key(
+    const hashmapq_t * h,
+    unsigned long hash
+)
+{
+    hash_node_t *n = __node(h, __probe(h->size, hash, 0));
+
+    if (n->key && n->key != &__tombstone)
+        __builtin_prefetch(n->key);
+}
+
+void hashmapq_get_batch(
+    hashmapq_t * h,
+    void **keys,
+    int nkeys,
+    void **vals
+)
+{
+    unsigned long hashes[BATCH_WINDOW];
+    int ii, jj;
+
+    assert(h->hash || h->seeded_hash);
+
+    /* the writer may be swapping arrays, so there's nothing to prefetch;
+     * a mapped map's slots hold file offsets, not pointers */
+    if (h->flags & (HASHMAPQ_CONCURRENT_READS | HASHMAPQ_LOCK_FREE |
+                    HASHMAPQ_MAPPED))
+    {
+        for (ii = 0; ii < nkeys; ii++)
+            vals[ii] = hashmapq_get(h, keys[ii]);
+        return;
+    }
+
+    if (0 == hashmapq_count(h))
+    {
+        memset(vals, 0, nkeys * sizeof(void*));
+        return;
+    }
+
+    __migrate(h, MIGRATE_SLOTS);
+
+    for (ii = 0; ii < nkeys; ii += BATCH_WINDOW)
+    {
+        int n = nkeys - ii < BATCH_WINDOW ? nkeys - ii : BATCH_WINDOW;
+
+        /* each stage's loads are in flight while the next key is handled */
+        for (jj = 0; jj < n; jj++)
+            if (keys[ii + jj])
+            {
+                hashes[jj] = __hash(h, keys[ii + jj]);
+                __prefetch(h, hashes[jj]);
+            }
+
+        for (jj = 0; jj < n; jj++)
+            if (keys[ii + jj])
+                __prefetch_key(h, hashes[jj]);
+
+        for (jj = 0; jj < n; jj++)
+            vals[ii + jj] = keys[ii + jj] ?
+                __get(h, keys[ii + jj], hashes[jj]) : NULL;
+    }
+}
+
+/**
+ * Is this key inside this map?
+ * @return 1 if key is in hash, otherwise 0 */
+int hashmapq_contains_key(
+    hashmapq_t * h,
+    const void *key
+)
+{
+    return (NULL != hashmapq_get(h, key));
+}
+
+int hashmapq_contains_key_with_hash(
+    hashmapq_t * h,
+    const void *key,
+    unsigned long hash
+)
+{
+    return (NULL != hashmapq_get_with_hash(h, key, hash));
+}
+
+/**
+ * Tombstone key within this array if it's there.
+ * @return 1 if the key was found, otherwise 0 */
+static int __remove_from(
+    hashmapq_t * h,
+    hash_node_t * array,
+    unsigned int *hashes,
+    int size,
+    hash_entry_t * entry,
+    const void *k,
+    unsigned long hash
+)
+{
+    hash_node_t *n;
+    int idx;
+
+    idx = __find(h, array, hashes, size, k, hash);
+    if (-1 == idx)
+        return 0;
+
+    n = &array[idx];
+    entry->key = n->key;
+    entry->val = n->val;
+    h->count--;
+
+    if (h->flags & HASHMAPQ_ROBIN_HOOD)
+    {
+        int from = idx;
+
+        idx = __rh_remove_at(array, hashes, size, idx);
+        h->slots_used--;
+        /* the rest of the cluster shifted back a slot */
+        for (; from != idx; from = (from + 1) & (size - 1))
+            __journal_mark(h, from);
+    }
+    else
+        __atomic_store_n(&n->key, (void*)&__tombstone, __ATOMIC_RELEASE);
+    __vacate(h, array, idx);
+
+    return 1;
+}
+
+/**
+ * Remove this key from the hash, given the key's hash. */
+static void __remove_entry(
+    hashmapq_t * h,
+    hash_entry_t * entry,
+    const void *k,
+    unsigned long hash
+)
+{
+    /* lock-free maps are insert only, and mapped ones read only */
+    assert(!(h->flags & (HASHMAPQ_LOCK_FREE | HASHMAPQ_MAPPED)));
+
+    __migrate(h, MIGRATE_SLOTS);
+
+    if (__remove_from(h, h->array, h->hashes, h->size, entry, k, hash) ||
+        (h->array_old &&
+         __remove_from(h, h->array_old, h->hashes_old, h->size_old,
+                       entry, k, hash)))
+    {
+        if (h->journal)
+            __journal_remove(h, k);
+        __shrink_if_sparse(h);
+        return;
+    }
+
+    entry->key = NULL;
+    entry->val = NULL;
+}
+
+/**
+ * Remove the value refrenced by this key from the hash. */
+void hashmapq_remove_entry(
+    hashmapq_t * h,
+    hash_entry_t * entry,
+    const void *k
+)
+{
+    if (0 == hashmapq_count(h) || !k)
+    {
+        entry->key = NULL;
+        entry->val = NULL;
+        return;
+    }
+
+    __remove_entry(h, entry, k, __hash(h, k));
+}
+
+/**
+ * Remove this key and value from the map.
+ * @return value of key, or NULL on failure */
+void *hashmapq_remove(
+    hashmapq_t * h,
+    const void *key
+)
+{
+    hash_entry_t entry;
+
+    hashmapq_remove_entry(h, &entry, key);
+    return (void *) entry.val;
+}
+
+void *hashmapq_remove_with_hash(
+    hashmapq_t * h,
+    const void *key,
+    unsigned long hash
+)
+{
+    hash_entry_t entry;
+
+    assert(!h->seeded_hash);
+
+    if (0 == hashmapq_count(h) || !key)
+        return NULL;
+
+    __remove_entry(h, &entry, key, __mix(h, hash));
+    return (void *) entry.val;
+}
+
+/**
+ * Find key, or insert it with val if it isn't there, given the key's hash.
+ * Only looks at the current array and does not check capacity.
+ * @param inserted set to 1 if key was inserted, 0 if it was already there
+ * @return node holding key */
+static hash_node_t *__insert(
+    hashmapq_t * h,
+    void *k,
+    void *v,
+    unsigned long hash,
+    int *inserted
+)
+{
+    hash_node_t *tomb = NULL;
+    unsigned int tomb_slot = 0;
+    unsigned int i;
+
+    if (h->flags & HASHMAPQ_ROBIN_HOOD)
+        return __rh_insert(h, k, v, hash, inserted);
+
+    /* we are always at least half full
+     * this guarantees we will be able to escape this loop */
+    for (i=0;;i++)
+    {
+        unsigned int new_slot;
+        hash_node_t *n;
+
+        new_slot = __probe(h->size, hash, i);
+        n = __node(h, new_slot);
+
+        if (n->key == &__tombstone)
+        {
+            /* the key might still be further along the chain.
+             * Concurrent readers rely on a slot's key never changing, so
+             * those maps don't reuse tombstones */
+            if (!tomb && !(h->flags & HASHMAPQ_CONCURRENT_READS))
+            {
+                tomb = n;
+                tomb_slot = new_slot;
+            }
+        }
+        else if (!n->key)
+        {
+            /* reuse the first tombstone we passed */
+            if (tomb)
+            {
+                n = tomb;
+                new_slot = tomb_slot;
+            }
+            else
+                h->slots_used += 1;
+
+            h->count++;
+            h->probes = i;
+            n->val = v;
+            if (h->hashes)
+                h->hashes[new_slot] = (unsigned int) hash;
+            __touch(h, new_slot);
+            /* publish the key last, readers then see a complete entry */
+            __atomic_store_n(&n->key, k, __ATOMIC_RELEASE);
+            *inserted = 1;
+            return n;
+        }
+        else if ((!h->hashes || h->hashes[new_slot] == (unsigned int) hash)
+                 && 0 == h->compare(k, n->key))
+        {
+            *inserted = 0;
+            return n;
+        }
+    }
+}
+
+/**
+ * Associate key with val, given the key's hash.
+ * Only looks at the current array and does not check capacity.
+ * @return previous associated val; otherwise NULL */
+static void *__put(
+    hashmapq_t * h,
+    void *k,
+    void *v,
+    unsigned long hash
+)
+{
+    hash_node_t *n;
+    void* old;
+    int inserted;
+
+    n = __insert(h, k, v, hash, &inserted);
+    if (inserted)
+        return NULL;
+
+    __journal_mark(h, n - (hash_node_t *) h->array);
+    old = n->val;
+    __atomic_store_n(&n->val, v, __ATOMIC_RELEASE);
+    return old;
+}
+
+/**
+ * Find key, or insert it with val if it isn't there, given the key's hash.
+ * @param inserted set to 1 if key was inserted, 0 if it was already there
+ * @return node holding key */
+static hash_node_t *__entry(
+    hashmapq_t * h,
+    void *k,
+    void *v,
+    unsigned long hash,
+    int *inserted
+)
+{
+    hash_node_t *n;
+
+    if (!__ensurecapacity(h))
+    {
+        /* a full fixed map can still replace the val of a key it has */
+        int idx = __find(h, h->array, h->hashes, h->size, k, hash);
+
+        if (-1 == idx)
+            return NULL;
+        *inserted = 0;
+        return __node(h, idx);
+    }
+
+    /* a key that hasn't been migrated yet moves over now */
+    if (h->array_old)
+    {
+        hash_entry_t entry;
+
+        if (__remove_from(h, h->array_old, h->hashes_old, h->size_old,
+                          &entry, k, hash))
+        {
+            n = __insert(h, entry.key, entry.val, hash, inserted);
+            *inserted = 0;
+            return n;
+        }
+    }
+
+    n = __insert(h, k, v, hash, inserted);
+    if (!*inserted)
+        return n;
+
+    /* what the map held at its fullest, for HASHMAPQ_SHRINK_ON_CLEAR */
+    if (h->count > h->peak)
+        h->peak = h->count;
+
+    if (__flood_limit(h) < h->probes)
+        n = __flooded(h, k, n);
+    return n;
+}
+
+/**
+ * Associate key with val, given the key's hash.
+ * @return previous associated val; HASHMAPQ_FULL if the map is
+ *  HASHMAPQ_FIXED and has no room for key; otherwise NULL */
+static void *__put_with_hash(
+    hashmapq_t * h,
+    void *k,
+    void *v,
+    unsigned long hash
+)
+{
+    hash_node_t *n;
+    void* old;
+    int inserted;
+
+    if (h->flags & HASHMAPQ_LOCK_FREE)
+        return __lf_put(h, k, v, hash);
+
+    n = __entry(h, k, v, hash, &inserted);
+    if (!n)
+        return HASHMAPQ_FULL;
+    if (h->journal)
+        __journal_put(h, k, v);
+    if (inserted)
+        return NULL;
+
+    __journal_mark(h, n - (hash_node_t *) h->array);
+    old = n->val;
+    __atomic_store_n(&n->val, v, __ATOMIC_RELEASE);
+    return old;
+}
+
+/**
+ * Associate key with val.
+ * Does not insert key if an equal key exists.
+ * @return previous associated val; HASHMAPQ_FULL if the map is
+ *  HASHMAPQ_FIXED and has no room for key; otherwise NULL */
+void *hashmapq_put(
+    hashmapq_t * h,
+    void *k,
+    void *v
+)
+{
+    if (!k || !v)
+        return NULL;
+
+    return __put_with_hash(h, k, v, __hash(h, k));
+}
+
+void *hashmapq_put_with_hash(
+    hashmapq_t * h,
+    void *k,
+    void *v,
+    unsigned long hash
+)
+{
+    assert(!h->seeded_hash);
+
+    if (!k || !v)
+        return NULL;
+
+    return __put_with_hash(h, k, v, __mix(h, hash));
+}
+
+void **hashmapq_get_or_put(
+    hashmapq_t * h,
+    void *k,
+    void *v,
+    int *inserted
+)
+{
+    hash_node_t *n;
+    int ins;
+
+    if (!k || !v)
+        return NULL;
+
+    /* the slot could be migrated away while the caller holds it */
+    assert(!(h->flags & HASHMAPQ_LOCK_FREE));
+
+    if (!inserted)
+        inserted = &ins;
+
+    n = __entry(h, k, v, __hash(h, k), inserted);
+    if (!n)
+        return NULL;
+
+    /* the caller may change the val in place; only a checkpoint sees that */
+    if (h->journal && *inserted)
+        __journal_put(h, k, v);
+    __journal_mark(h, n - (hash_node_t *) h->array);
+    return &n->val;
+}
+
+void hashmapq_put_batch(
+    hashmapq_t * h,
+    void **keys,
+    void **vals,
+    int nkeys,
+    void **old_vals
+)
+{
+    unsigned long hashes[BATCH_WINDOW];
+    int ii, jj;
+
+    assert(h->hash || h->seeded_hash);
+
+    if (h->flags & HASHMAPQ_LOCK_FREE)
+    {
+        for (ii = 0; ii < nkeys; ii++)
+        {
+            void *old = hashmapq_put(h, keys[ii], vals[ii]);
+
+            if (old_vals)
+                old_vals[ii] = old;
+        }
+        return;
+    }
+
+    for (ii = 0; ii < nkeys; ii += BATCH_WINDOW)
+    {
+        int n = nkeys - ii < BATCH_WINDOW ? nkeys - ii : BATCH_WINDOW;
+
+        for (jj = 0; jj < n; jj++)
+            if (keys[ii + jj] && vals[ii + jj])
+            {
+                hashes[jj] = __hash(h, keys[ii + jj]);
+                __prefetch(h, hashes[jj]);
+            }
+
+        for (jj = 0; jj < n; jj++)
+        {
+            void *old = NULL;
+
+            if (keys[ii + jj] && vals[ii + jj])
+                old = __put_with_hash(h, keys[ii + jj], vals[ii + jj],
+                                      hashes[jj]);
+            if (old_vals)
+                old_vals[ii + jj] = old;
+        }
+    }
+}
+
+/**
+ * Put this key/value entry into the hash */
+void hashmapq_put_entry(
+    hashmapq_t * h,
+    hash_entry_t * entry
+)
+{
+    hashmapq_put(h, entry->key, entry->val);
+}
+
+/**
+ * Move everything into a new array of new_size. */
+static void __rehash(
+    hashmapq_t * h,
+    int new_size
+)
+{
+    if (h->array_old)
+        __migrate(h, h->size_old);
+    __start_resize(h, new_size);
+    __migrate(h, h->size_old);
+}
+
+static unsigned long __random_seed(
+    const hashmapq_t * h
+)
+{
+    unsigned long seed = 0;
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+
+    if (-1 != fd)
+    {
+        if (sizeof(seed) != read(fd, &seed, sizeof(seed)))
+            seed = 0;
+        close(fd);
+    }
+
+    /* no good, but at least it differs between maps and runs */
+    if (!seed)
+        seed = hashmapq_mix((unsigned long) h ^ (unsigned long) &seed ^
+                            (unsigned long) time(NULL));
+    return seed;
+}
+
+/**
+ * Pick a new seed and move everything to where it now hashes to. */
+static void __reseed(
+    hashmapq_t * h
+)
+{
+    int ii;
+
+    if (h->array_old)
+        __migrate(h, h->size_old);
+
+    h->seed = __random_seed(h);
+    h->reseed_size = h->size;
+
+    /* seeded maps always store hashes, and these were made under the old
+     * seed */
+    for (ii = 0; ii < h->size; ii++)
+    {
+        hash_node_t *n = __node(h, ii);
+
+        if (n->key && n->key != &__tombstone)
+            h->hashes[ii] = __hash(h, n->key);
+    }
+
+    __rehash(h, h->size);
+}
+
+/**
+ * Key k was just put into node n, and took more than __flood_limit()
+ * probes.
+ * @return node holding k, which a reseed may have moved */
+static hash_node_t *__flooded(
+    hashmapq_t * h,
+    const void *k,
+    hash_node_t * n
+)
+{
+    int probes = h->probes;
+
+    /* a seed that is still flooded after a reseed is bad luck, or a hash
+     * that ignores its seed; don't rehash on every put over it */
+    if (h->seeded_hash && h->reseed_size != h->size)
+    {
+        __reseed(h);
+        n = __node(h, __find(h, h->array, h->hashes, h->size, k,
+                             __hash(h, k)));
+    }
+
+    if (h->on_flood)
+        h->on_flood(h, probes, h->flood_udata);
+
+    return n;
+}
+
+hashmapq_t *hashmapq_new_seeded(
+    func_seeded_hash_f hash,
+    func_longcmp_f cmp,
+    unsigned int initial_capacity,
+    int flags
+)
+{
+    hashmapq_t *h;
+
+    assert(hash);
+    /* readers hashing under the old seed would miss keys mid-reseed */
+    assert(!(flags & (HASHMAPQ_CONCURRENT_READS | HASHMAPQ_LOCK_FREE)));
+
+    /* without a hash callback the map stores every hash, which a reseed
+     * recomputes */
+    h = hashmapq_new_with_flags(NULL, cmp, initial_capacity, flags);
+    h->seeded_hash = hash;
+    h->seed = __random_seed(h);
+    return h;
+}
+
+void hashmapq_set_flood_callback(
+    hashmapq_t * h,
+    func_flood_f fn,
+    void *udata
+)
+{
+    h->on_flood = fn;
+    h->flood_udata = udata;
+}
+
+/**
+ * Increase hash capacity. */
+void hashmapq_increase_capacity(hashmapq_t * h)
+{
+    assert(!(h->flags & HASHMAPQ_FIXED));
+
+    if (h->flags & HASHMAPQ_LOCK_FREE)
+    {
+        __lf_next(h, h->table);
+        __lf_settle(h);
+        return;
+    }
+
+    __rehash(h, h->size << 1);
+}
+
+#define PENDING_TEST(p, i) ((p)[(i) / 8] & (1 << ((i) % 8)))
+#define PENDING_FLIP(p, i) ((p)[(i) / 8] ^= (1 << ((i) % 8)))
+
+/**
+ * Drop all tombstones by reinserting every entry without growing the array.
+ * Entries that haven't been placed yet are tracked in a bitmap; placing an
+ * entry onto a slot that holds an unplaced one swaps them. */
+static void __rehash_in_place(
+    hashmapq_t * h
+)
+{
+    unsigned char *pending;
+    int ii;
+
+    if (h->journal)
+        ((journal_t *) h->journal)->full = 1;
+
+    assert(!h->array_old);
+
+    if (h->flags & HASHMAPQ_FIXED)
+    {
+        size_t array, hashes, npending;
+
+        __buffer_layout(h->size, h->flags, &array, &hashes, &npending);
+        pending = (unsigned char *) h->array + array + hashes;
+        memset(pending, 0, npending);
+    }
+    else
+        pending = __calloc(h, h->size / 8 + 1, 1);
+
+    for (ii = 0; ii < h->size; ii++)
+    {
+        hash_node_t *n = __node(h, ii);
+
+        if (n->key == &__tombstone)
+            n->key = NULL;
+        else if (n->key)
+            PENDING_FLIP(pending, ii);
+    }
+
+    h->slots_used = h->count;
+
+    for (ii = 0; ii < h->size; ii++)
+    {
+        hash_node_t e;
+        unsigned long hash;
+        unsigned int i;
+
+        if (!PENDING_TEST(pending, ii))
+            continue;
+
+        PENDING_FLIP(pending, ii);
+        e = *__node(h, ii);
+        hash = h->hashes ? h->hashes[ii] : __hash(h, e.key);
+        __node(h, ii)->key = NULL;
+        __vacate(h, h->array, ii);
+
+        for (i=0;;i++)
+        {
+            unsigned int new_slot;
+            hash_node_t *n;
+
+            new_slot = __probe(h->size, hash, i);
+            n = __node(h, new_slot);
+
+            if (!n->key)
+            {
+                *n = e;
+                if (h->hashes)
+                    h->hashes[new_slot] = (unsigned int) hash;
+                __touch(h, new_slot);
+                break;
+            }
+            else if (PENDING_TEST(pending, new_slot))
+            {
+                hash_node_t tmp = *n;
+
+                PENDING_FLIP(pending, new_slot);
+                *n = e;
+                e = tmp;
+                if (h->hashes)
+                {
+                    unsigned long tmp_hash = h->hashes[new_slot];
+
+                    h->hashes[new_slot] = (unsigned int) hash;
+                    hash = tmp_hash;
+                }
+                else
+                    hash = __hash(h, e.key);
+
+                /* start placing the displaced entry */
+                i = -1;
+            }
+        }
+    }
+
+    if (!(h->flags & HASHMAPQ_FIXED))
+        __free(h, pending);
+}
+
+/**
+ * Rehash at the same size to get rid of tombstones.
+ * Readers might be walking the array, so concurrent maps get a new one. */
+static void __drop_tombstones(
+    hashmapq_t * h
+)
+{
+    if (h->flags & HASHMAPQ_CONCURRENT_READS)
+        __rehash(h, h->size);
+    else
+        __rehash_in_place(h);
+}
+
+/**
+ * Remove all tombstones from the hash. */
+void hashmapq_compact(hashmapq_t * h)
+{
+    /* there is nothing to remove tombstones for */
+    if (h->flags & HASHMAPQ_LOCK_FREE)
+        return;
+
+    if (h->array_old)
+        __migrate(h, h->size_old);
 
-    assert(0 == hashmapq_count(h));
+    if (h->slots_used != h->count)
+        __drop_tombstones(h);
 }
 
-/**
- * Free all the memory related to this hash. */
-void hashmapq_free(
+static int __ensurecapacity(
     hashmapq_t * h
 )
 {
-    assert(h);
-    hashmapq_clear(h);
+    assert(!(h->flags & HASHMAPQ_MAPPED));
+
+    if (h->array_old)
+        __migrate(h, MIGRATE_SLOTS);
+
+    if ((float) h->slots_used / h->size < h->max_load)
+    {
+        return 1;
+    }
+    else if (!h->array_old && (float) h->count / h->size < h->max_load / 2)
+    {
+        /* tombstones filled us up; there's no need to grow */
+        __drop_tombstones(h);
+    }
+    else if (h->flags & HASHMAPQ_FIXED)
+    {
+        /* we can't grow, so make what room we can */
+        if (h->slots_used == h->count)
+            return 0;
+        __drop_tombstones(h);
+        return (float) h->slots_used / h->size < h->max_load;
+    }
+    else if ((h->flags & HASHMAPQ_INCREMENTAL_RESIZE) && !h->array_old)
+    {
+        __start_resize(h, h->size << 1);
+    }
+    else
+    {
+        hashmapq_increase_capacity(h);
+    }
+    return 1;
 }
 
 /**
- * Free all the memory related to this hash.
- * This includes the actual h itself. */
-void hashmapq_freeall(
+ * Halve the array once the count drops below the map's min load factor.
+ * Never shrinks below the initial capacity. */
+static void __shrink_if_sparse(
     hashmapq_t * h
 )
 {
-    assert(h);
-    hashmapq_free(h);
-    free(h);
+    if (!h->min_load || h->array_old || h->size / 2 < h->initial_size ||
+        (float) h->count / h->size >= h->min_load)
+        return;
+
+    if (h->flags & HASHMAPQ_INCREMENTAL_RESIZE)
+        __start_resize(h, h->size / 2);
+    else
+        __rehash(h, h->size / 2);
 }
 
-/**
- * Get this key's value.
- * @return key's item, otherwise NULL */
-void *hashmapq_get(
+void hashmapq_reserve(
     hashmapq_t * h,
-    const void *key
+    int n
 )
 {
-    unsigned int slot;
-    hash_node_t *n;
-
-    if (0 == hashmapq_count(h) || !key)
-        return NULL;
+    int size = h->size;
 
-    slot = h->hash(key);
-    n = &((hash_node_t *) h->array)[slot % h->size];
+    assert(!(h->flags & (HASHMAPQ_FIXED | HASHMAPQ_LOCK_FREE)));
 
-    int new_slot;
-    int i;
+    while (n > size * h->max_load)
+        size <<= 1;
 
-    for (i=0;;i++)
-    {
-        new_slot = (slot + (i/2) + (i * i)/2) % h->size;
-        n = &((hash_node_t *) h->array)[new_slot];
-
-        if (!n->key) break;
-        if (n->key == (void*)&__tombstone) continue;
-
-        if (0 == h->compare(key, n->key))
-        {
-            return (void *) n->val;
-        }
-    }
+    if (h->array_old)
+        __migrate(h, h->size_old);
 
-    return NULL;
+    if (size != h->size)
+        __rehash(h, size);
+    else if (h->slots_used - h->count + n > size * h->max_load)
+        /* there's room, once tombstones are out of the way */
+        __drop_tombstones(h);
 }
 
-/**
- * Is this key inside this map?
- * @return 1 if key is in hash, otherwise 0 */
-int hashmapq_contains_key(
+void hashmapq_build(
     hashmapq_t * h,
-    const void *key
+    const hash_entry_t * entries,
+    int n
 )
 {
-    return (NULL != hashmapq_get(h, key));
-}
+    unsigned long hashes[BATCH_WINDOW];
+    int ii, jj;
 
-/**
- * Remove the value refrenced by this key from the hash. */
-void hashmapq_remove_entry(
-    hashmapq_t * h,
-    hash_entry_t * entry,
-    const void *k
-)
-{
-    hash_node_t *n;
-    int slot;
-    int i;
+    assert(h->hash || h->seeded_hash);
 
-    slot = h->hash(k);
-    n = &((hash_node_t *) h->array)[slot % h->size];
+    /* those maps can't be sized up front; a full fixed map drops the
+     * entries it has no room for */
+    if (h->flags & (HASHMAPQ_FIXED | HASHMAPQ_LOCK_FREE))
+    {
+        for (ii = 0; ii < n; ii++)
+            hashmapq_put(h, entries[ii].key, entries[ii].val);
+        return;
+    }
 
-    if (!n->key)
-        goto notfound;
+    hashmapq_reserve(h, h->count + n);
 
-    for (i=0;;i++)
+    /* the array is big enough for everything, so it can't move under the
+     * prefetches */
+    for (ii = 0; ii < n; ii += BATCH_WINDOW)
     {
-        int new_slot;
+        int m = n - ii < BATCH_WINDOW ? n - ii : BATCH_WINDOW;
 
-        new_slot = (slot + (i/2) + (i * i)/2) % h->size;
-        n = &((hash_node_t *) h->array)[new_slot];
-
-        if (!n->key) goto notfound;
-        if (n->key == (void*)&__tombstone) continue;
+        for (jj = 0; jj < m; jj++)
+            if (entries[ii + jj].key && entries[ii + jj].val)
+            {
+                hashes[jj] = __hash(h, entries[ii + jj].key);
+                __prefetch(h, hashes[jj]);
+            }
 
-        if (0 == h->compare(k, n->key))
-        {
-            n->key = &__tombstone;
-            h->count--;
-            entry->key = n->key;
-            entry->val = n->val;
-            return;
-        }
+        for (jj = 0; jj < m; jj++)
+            if (entries[ii + jj].key && entries[ii + jj].val)
+            {
+                __put(h, entries[ii + jj].key, entries[ii + jj].val,
+                      hashes[jj]);
+                if (h->journal)
+                    __journal_put(h, entries[ii + jj].key,
+                                  entries[ii + jj].val);
+            }
     }
-   
-notfound:
-    entry->key = NULL;
-    entry->val = NULL;
+
+    if (h->count > h->peak)
+        h->peak = h->count;
 }
 
-/**
- * Remove this key and value from the map.
- * @return value of key, or NULL on failure */
-void *hashmapq_remove(
-    hashmapq_t * h,
-    const void *key
-)
+/* one thread's share of a parallel build or resize */
+typedef struct
 {
-    hash_entry_t entry;
-
-    hashmapq_remove_entry(h, &entry, key);
-    return (void *) entry.val;
-}
+    hashmapq_t *h;
+    /* entries to put, or NULL when moving the slots of the old array */
+    const hash_entry_t *entries;
+    int start;
+    int end;
+    /* empty slots this thread claimed */
+    int inserted;
+} build_job_t;
 
 /**
- * Associate key with val.
- * Does not insert key if an equal key exists.
- * @return previous associated val; otherwise NULL */
-void *hashmapq_put(
-    hashmapq_t * h,
+ * Put a key into the array alongside other threads doing the same. Empty
+ * slots are claimed with compare-and-swap, so a key that two threads race
+ * to insert still lands in one slot.
+ * @param fresh the key is known not to be in the array yet */
+static void __claim(
+    build_job_t * job,
     void *k,
-    void *v
+    void *v,
+    unsigned long hash,
+    int fresh
 )
 {
-    hash_node_t *n;
-    int slot;
+    hashmapq_t *h = job->h;
+    unsigned int i;
 
-    if (!k || !v)
-        return NULL;
+    for (i = 0;; i++)
+    {
+        unsigned int idx = __probe(h->size, hash, i);
+        hash_node_t *n = __node(h, idx);
+        void *key = NULL;
 
-    __ensurecapacity(h);
+        if (__atomic_compare_exchange_n(&n->key, &key, k, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            __atomic_store_n(&n->val, v, __ATOMIC_RELAXED);
+            if (h->hashes)
+                h->hashes[idx] = (unsigned int) hash;
+            job->inserted++;
+            return;
+        }
 
-    slot = h->hash(k);
+        if (!fresh && key != &__tombstone && 0 == h->compare(k, key))
+        {
+            __atomic_store_n(&n->val, v, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+}
 
-    int new_slot;
-    int i;
+static void *__build_worker(
+    void *arg
+)
+{
+    build_job_t *job = arg;
+    hashmapq_t *h = job->h;
+    int ii;
 
-    /* we are always at least half full
-     * this guarantees we will be able to escape this loop */
-    for (i=0;;i++)
+    for (ii = job->start; ii < job->end; ii++)
     {
-        new_slot = (slot + (i/2) + (i * i)/2) % h->size;
-        n = &((hash_node_t *) h->array)[new_slot];
-
-        if (!n->key || n->key == &__tombstone)
+        if (job->entries)
         {
-            /* Don't double increment if we are replacing an item */
-            if (!n->key)
-            {
-                h->slots_used += 1;
-                h->count++;
-            }
+            const hash_entry_t *e = &job->entries[ii];
 
-            n->key = k;
-            n->val = v;
-            return NULL;
+            if (e->key && e->val)
+                __claim(job, e->key, e->val, __hash(h, e->key), 0);
         }
-        else if (0 == h->compare(k, n->key))
+        else
         {
-            void* old;
+            hash_node_t *n = &((hash_node_t *) h->array_old)[ii];
 
-            old = n->val;
-            n->val = v;
-            return old;
+            if (n->key && n->key != &__tombstone)
+                __claim(job, n->key, n->val, h->hashes_old ?
+                        h->hashes_old[ii] : __hash(h, n->key), 1);
         }
     }
+
+    return NULL;
 }
 
 /**
- * Put this key/value entry into the hash */
-void hashmapq_put_entry(
+ * Split n items between nthreads threads.
+ * @return number of empty slots the threads claimed */
+static int __run_jobs(
     hashmapq_t * h,
-    hash_entry_t * entry
+    const hash_entry_t * entries,
+    int n,
+    int nthreads
 )
 {
-    hashmapq_put(h, entry->key, entry->val);
+    build_job_t *jobs = __calloc(h, nthreads, sizeof(build_job_t));
+    pthread_t *threads = __calloc(h, nthreads, sizeof(pthread_t));
+    int *started = __calloc(h, nthreads, sizeof(int));
+    int ii, inserted = 0;
+
+    for (ii = 0; ii < nthreads; ii++)
+    {
+        jobs[ii].h = h;
+        jobs[ii].entries = entries;
+        jobs[ii].start = (long long) n * ii / nthreads;
+        jobs[ii].end = (long long) n * (ii + 1) / nthreads;
+        started[ii] = 0 == pthread_create(&threads[ii], NULL, __build_worker,
+                                          &jobs[ii]);
+        /* do it ourselves if we can't get a thread */
+        if (!started[ii])
+            __build_worker(&jobs[ii]);
+    }
+
+    for (ii = 0; ii < nthreads; ii++)
+    {
+        if (started[ii])
+            pthread_join(threads[ii], NULL);
+        inserted += jobs[ii].inserted;
+    }
+
+    __free(h, jobs);
+    __free(h, threads);
+    __free(h, started);
+    return inserted;
 }
 
 /**
- * Increase hash capacity. */
-void hashmapq_increase_capacity(hashmapq_t * h)
+ * Mark every key in the array as written, after threads filled it without
+ * doing so. */
+static void __touch_all(
+    hashmapq_t * h
+)
 {
-    hash_node_t *array_old;
-    int ii, asize_old;
-
-    /*  stored old array */
-    array_old = h->array;
-    asize_old = h->size;
+    int ii;
 
-    h->count = 0;
-    h->slots_used = 0;
-    h->size <<= 1;
-    h->array = calloc(h->size, sizeof(hash_node_t));
+    if (!(h->flags & (HASHMAPQ_FAST_CLEAR | HASHMAPQ_OCCUPANCY_BITMAP)))
+        return;
 
-    for (ii=0; ii < asize_old; ii++)
+    for (ii = 0; ii < h->size; ii++)
     {
-        hash_node_t *n;
-        
-        n = &((hash_node_t *) array_old)[ii];
-
-        if (!n->key || n->key == &__tombstone)
-            continue;
+        void *k = __node(h, ii)->key;
 
-        hashmapq_put(h, n->key, n->val);
+        if (k && k != &__tombstone)
+            __touch(h, ii);
     }
-
-    free(array_old);
 }
 
-static void __ensurecapacity(
-    hashmapq_t * h
+void hashmapq_build_parallel(
+    hashmapq_t * h,
+    const hash_entry_t * entries,
+    int n,
+    int nthreads
 )
 {
-    if ((float) h->slots_used / h->size < SPACERATIO)
+    int inserted;
+
+    /* Robin Hood displaces entries, and the rest can't be sized up front,
+     * have readers that mustn't see half-written slots, or journal each
+     * put */
+    if (nthreads < 2 || h->journal ||
+        (h->flags & (HASHMAPQ_ROBIN_HOOD | HASHMAPQ_CONCURRENT_READS |
+                     HASHMAPQ_LOCK_FREE | HASHMAPQ_FIXED)))
     {
+        hashmapq_build(h, entries, n);
         return;
     }
-    else
+
+    assert(h->hash || h->seeded_hash);
+
+    hashmapq_reserve(h, h->count + n);
+    inserted = __run_jobs(h, entries, n, nthreads);
+    h->count += inserted;
+    h->slots_used += inserted;
+    __touch_all(h);
+
+    if (h->count > h->peak)
+        h->peak = h->count;
+}
+
+void hashmapq_increase_capacity_parallel(
+    hashmapq_t * h,
+    int nthreads
+)
+{
+    if (nthreads < 2 ||
+        (h->flags & (HASHMAPQ_ROBIN_HOOD | HASHMAPQ_CONCURRENT_READS |
+                     HASHMAPQ_LOCK_FREE)))
     {
         hashmapq_increase_capacity(h);
+        return;
     }
+
+    assert(!(h->flags & HASHMAPQ_FIXED));
+
+    if (h->array_old)
+        __migrate(h, h->size_old);
+
+    __start_resize(h, h->size << 1);
+    h->slots_used = __run_jobs(h, NULL, h->size_old, nthreads);
+    __touch_all(h);
+
+    /* everything has moved; let go of the old array */
+    h->migrate_cur = h->size_old;
+    __migrate(h, 0);
+}
+
+/**
+ * Robin Hood removes shift entries backwards, so those maps are walked
+ * downwards starting from an empty slot. Anything shifted by a remove then
+ * lands on a slot we have already been past.
+ * @return array index of the iterator's position */
+static int __iter_slot(
+    hashmapq_t * h,
+    hashmapq_iterator_t * iter
+)
+{
+    if (!(h->flags & HASHMAPQ_ROBIN_HOOD))
+        return iter->cur;
+    return (iter->start - 1 - iter->cur) & (h->size - 1);
+}
+
+/**
+ * @return number of slots the iterator walks */
+static int __iter_size(
+    hashmapq_t * h,
+    hashmapq_iterator_t * iter
+)
+{
+    if (iter->table)
+        return ((table_t *) iter->table)->size;
+    return h->size;
+}
+
+/**
+ * @return node at the iterator's position */
+static hash_node_t *__iter_node(
+    hashmapq_t * h,
+    hashmapq_iterator_t * iter
+)
+{
+    if (iter->table)
+        return &((table_t *) iter->table)->array[iter->cur];
+    return __node(h, __iter_slot(h, iter));
+}
+
+/**
+ * @return key at the iterator's position; maybe NULL or a tombstone */
+static void *__iter_key(
+    hashmapq_t * h,
+    hashmapq_iterator_t * iter
+)
+{
+    return __atomic_load_n(&__iter_node(h, iter)->key, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Reads the val straight out of the slot rather than looking the key up.
+ * @return val at the iterator's position */
+static void *__iter_val(
+    hashmapq_t * h,
+    hashmapq_iterator_t * iter
+)
+{
+    return __atomic_load_n(&__iter_node(h, iter)->val, __ATOMIC_ACQUIRE);
 }
 
 void* hashmapq_iterator_peek(
@@ -363,14 +3931,12 @@ void* hashmapq_iterator_peek(
     hashmapq_iterator_t * iter
 )
 {
-    for (; iter->cur < h->size; iter->cur++)
+    for (; iter->cur < __iter_size(h, iter); iter->cur++)
     {
-        hash_node_t *n;
+        void *k = __iter_key(h, iter);
 
-        n = &((hash_node_t *) h->array)[iter->cur];
-
-        if (n->key && n->key != &__tombstone)
-            return n->key;
+        if (k && k != &__tombstone)
+            return k;
     }
 
     return NULL;
@@ -381,7 +3947,9 @@ void* hashmapq_iterator_peek_value(
     hashmapq_t * h,
     hashmapq_iterator_t * iter)
 {
-    return hashmapq_get(h,hashmapq_iterator_peek(h,iter));
+    if (!hashmapq_iterator_peek(h, iter))
+        return NULL;
+    return __iter_val(h, iter);
 }
 
 int hashmapq_iterator_has_next(
@@ -400,11 +3968,28 @@ void *hashmapq_iterator_next_value(
     hashmapq_iterator_t * iter
 )
 {
-    void* k;
-    
-    k = hashmapq_iterator_next(h,iter);
-    if (!k) return NULL;
-    return hashmapq_get(h,k);
+    void *v;
+
+    if (!hashmapq_iterator_peek(h, iter))
+        return NULL;
+    v = __iter_val(h, iter);
+    iter->cur++;
+    return v;
+}
+
+int hashmapq_iterator_next_entry(
+    hashmapq_t * h,
+    hashmapq_iterator_t * iter,
+    hash_entry_t * entry
+)
+{
+    if (!hashmapq_iterator_peek(h, iter))
+        return 0;
+
+    entry->key = __iter_key(h, iter);
+    entry->val = __iter_val(h, iter);
+    iter->cur++;
+    return 1;
 }
 
 /**
@@ -415,18 +4000,16 @@ void *hashmapq_iterator_next(
     hashmapq_iterator_t * iter
 )
 {
-    hash_node_t *n;
-
     assert(iter);
 
-    for (; iter->cur < h->size; iter->cur++)
+    for (; iter->cur < __iter_size(h, iter); iter->cur++)
     {
-        n = &((hash_node_t *) h->array)[iter->cur];
+        void *k = __iter_key(h, iter);
 
-        if (!n->key || n->key == &__tombstone) continue;
+        if (!k || k == &__tombstone) continue;
 
         iter->cur++;
-        return n->key;
+        return k;
     }
 
     return NULL;
@@ -434,14 +4017,87 @@ void *hashmapq_iterator_next(
 
 /**
  * Initialise a new hash iterator over this hash
- * It is safe to remove items while iterating.
+ * It is safe to remove items while iterating. With HASHMAPQ_ROBIN_HOOD only
+ * the key just returned may be removed, as backward shifting moves the
+ * entries after it.
  */
 void hashmapq_iterator(
-    hashmapq_t * h __attribute__((__unused__)),
+    hashmapq_t * h,
     hashmapq_iterator_t * iter
 )
 {
+    /* mapped slots don't hold pointers */
+    assert(!(h->flags & HASHMAPQ_MAPPED));
+
+    /* iterators only walk the current array */
+    if (h->array_old)
+        __migrate(h, h->size_old);
+    if (h->flags & HASHMAPQ_LOCK_FREE)
+        __lf_settle(h);
     iter->cur = 0;
+    iter->start = 0;
+    iter->table = NULL;
+
+    /* stick with the array readers could see when we started */
+    if (h->flags & HASHMAPQ_CONCURRENT_READS)
+        iter->table = __atomic_load_n((table_t **) &h->table,
+                                      __ATOMIC_SEQ_CST);
+
+    if (h->flags & HASHMAPQ_ROBIN_HOOD)
+        while (__node(h, iter->start)->key)
+            iter->start++;
+}
+
+/**
+ * Call cb with every key and val in the map, stopping early if cb returns
+ * non-zero. cb must not put or remove. */
+int hashmapq_for_each(
+    hashmapq_t * h,
+    func_visit_f cb,
+    void *udata
+)
+{
+    int ii, ret;
+
+    assert(!(h->flags & HASHMAPQ_MAPPED));
+
+    if (h->array_old)
+        __migrate(h, h->size_old);
+    if (h->flags & HASHMAPQ_LOCK_FREE)
+        __lf_settle(h);
+
+    if (h->occupied)
+    {
+        for (ii = 0; ii < __nchunks(h->size); ii++)
+        {
+            unsigned long long bits = h->occupied[ii];
+
+            for (; bits; bits &= bits - 1)
+            {
+                hash_node_t *n =
+                    __node(h, ii * CLEAR_CHUNK + __builtin_ctzll(bits));
+
+                if ((ret = cb(n->key, n->val, udata)))
+                    return ret;
+            }
+        }
+
+        return 0;
+    }
+
+    for (ii = 0; ii < h->size; ii++)
+    {
+        hash_node_t *n = __node(h, ii);
+        void *k = __atomic_load_n(&n->key, __ATOMIC_ACQUIRE);
+
+        if (!k || k == &__tombstone)
+            continue;
+
+        if ((ret = cb(k, n->val, udata)))
+            return ret;
+    }
+
+    return 0;
 }
 
 /*--------------------------------------------------------------79-characters-*/
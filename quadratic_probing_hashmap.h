@@ -1,16 +1,112 @@
 #ifndef QUADRATIC_PROBING_HASHMAP_H
 #define QUADRATIC_PROBING_HASHMAP_H
 
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef unsigned long (*func_longhash_f) (const void *);
 
 typedef long (*func_longcmp_f) (const void *, const void *);
 
+/* a hash that an unknown seed makes unpredictable; see hashmapq_new_seeded() */
+typedef unsigned long (*func_seeded_hash_f) (const void *key,
+                                             unsigned long seed);
+
+/* writes item's bytes to buf for hashmapq_save(), if they fit in len.
+ * Otherwise it is called again with a bigger buf.
+ * @return bytes item needs */
+typedef size_t (*func_serialize_f) (const void *item, void *buf, size_t len);
+
+/* called by hashmapq_for_each(); a non-zero return stops the walk */
+typedef int (*func_visit_f) (void *key, void *val, void *udata);
+
+/* called when a put had to probe suspiciously far; see
+ * hashmapq_set_flood_callback() */
+typedef void (*func_flood_f) (void *hmap, int probes, void *udata);
+
 typedef struct
 {
     void *key;
     void *val;
 } hash_entry_t;
 
+/* where a map gets its memory; see hashmapq_new_with_allocator() */
+typedef struct
+{
+    void *(*alloc) (size_t size, void *udata);
+    void *(*realloc) (void *ptr, size_t size, void *udata);
+    void (*free) (void *ptr, void *udata);
+    /* passed through to each callback */
+    void *udata;
+} hashmapq_allocator_t;
+
+/* returned by put when a HASHMAPQ_FIXED map has no room for a new key */
+extern const char hashmapq_full_marker;
+#define HASHMAPQ_FULL ((void *) &hashmapq_full_marker)
+
+/* flags for hashmapq_new_with_flags() */
+enum
+{
+    /* cache the low 32 bits of each key's hash next to its slot.
+     * Rehashing never calls the hash callback, and probing only calls the
+     * compare callback when the cached hashes match */
+    HASHMAPQ_STORE_HASH = 1 << 0,
+    /* grow by keeping the old array alive and migrating a few of its slots
+     * on each put/get/remove, instead of reinserting everything inside a
+     * single put */
+    HASHMAPQ_INCREMENTAL_RESIZE = 1 << 1,
+    /* linear probing with Robin Hood displacement and backward-shift
+     * deletion. There are no tombstones, misses stop early, and the table
+     * can run at a much higher load factor. Implies HASHMAPQ_STORE_HASH;
+     * can't be combined with HASHMAPQ_INCREMENTAL_RESIZE */
+    HASHMAPQ_ROBIN_HOOD = 1 << 2,
+    /* one writer, any number of reader threads. Gets never lock or write
+     * shared cache lines other than a per-thread reader count, and resizes
+     * publish a new array once it is complete, freeing the old one after
+     * readers have moved on. Removed slots aren't reused until the next
+     * resize. Can't be combined with HASHMAPQ_ROBIN_HOOD or
+     * HASHMAPQ_INCREMENTAL_RESIZE */
+    HASHMAPQ_CONCURRENT_READS = 1 << 3,
+    /* any number of threads may put and get at once without locks. Puts
+     * claim a slot's key with compare-and-swap, and threads that find the
+     * array full help copy it into its successor. Insert only: keys can't
+     * be removed and put won't replace an existing key's val. Outgrown
+     * arrays are kept until clear or free. Iterate, clear, compact and
+     * increase capacity only when no other thread is using the map. Needs
+     * a hash callback; can't be combined with other flags */
+    HASHMAPQ_LOCK_FREE = 1 << 4,
+    /* the map lives in a caller's buffer and never allocates or grows.
+     * Set by hashmapq_init_in_buffer() */
+    HASHMAPQ_FIXED = 1 << 5,
+    /* remember which parts of the array have been written to, so clear
+     * only wipes those. A big map that is reused for small jobs then
+     * clears in time proportional to the last job, not the map's size */
+    HASHMAPQ_FAST_CLEAR = 1 << 6,
+    /* every few clears, swap the (empty) array for a smaller one if the
+     * count never came close to needing it since. Never shrinks below
+     * the initial capacity */
+    HASHMAPQ_SHRINK_ON_CLEAR = 1 << 7,
+    /* keep a bit per slot saying whether it holds a key, so
+     * hashmapq_for_each() skips 64 empty slots at a time instead of
+     * loading each one. Costs a bit per slot and a little work on each
+     * put and remove; worth it for sparse maps that are walked often.
+     * Can't be combined with HASHMAPQ_CONCURRENT_READS, HASHMAPQ_LOCK_FREE
+     * or HASHMAPQ_FIXED */
+    HASHMAPQ_OCCUPANCY_BITMAP = 1 << 8,
+    /* a read-only map of a file written by hashmapq_save(). Set by
+     * hashmapq_open_mmap() */
+    HASHMAPQ_MAPPED = 1 << 9,
+    /* run every hash, the hash callback's and those passed to the
+     * _with_hash variants, through hashmapq_mix() before picking slots.
+     * Slots are picked by the hash's low bits, so weak hashes such as
+     * the identity on pointers or sequential integers otherwise pile
+     * into long probe chains */
+    HASHMAPQ_MIX_HASH = 1 << 10,
+};
+
 typedef struct
 {
     /* this is inclusive of tombstones */
@@ -22,19 +118,325 @@ typedef struct
     void *array;
     func_longhash_f hash;
     func_longcmp_f compare;
+    int flags;
+    /* cached hashes, one per slot; only with HASHMAPQ_STORE_HASH */
+    unsigned int *hashes;
+    /* the array we are migrating away from during an incremental resize */
+    void *array_old;
+    unsigned int *hashes_old;
+    int size_old;
+    /* next slot of array_old to migrate */
+    int migrate_cur;
+    /* the array readers use; only with HASHMAPQ_CONCURRENT_READS */
+    void *table;
+    /* per-thread counts of readers inside a read section */
+    void *readers;
+    /* flipped by the writer to wait out readers of an old array */
+    int epoch;
+    /* every array, oldest first; only with HASHMAPQ_LOCK_FREE */
+    void *tables;
+    hashmapq_allocator_t allocator;
+    /* chunks of the array written since the last clear, as a bitmap and
+     * as a list; only with HASHMAPQ_FAST_CLEAR */
+    unsigned char *dirty;
+    int *dirty_list;
+    int ndirty;
+    /* highest count, and clears, since HASHMAPQ_SHRINK_ON_CLEAR last
+     * looked at shrinking */
+    int peak;
+    int clears;
+    int initial_size;
+    /* grow once this fraction of the array's slots are used */
+    float max_load;
+    /* halve the array once the count drops below this fraction of it; 0
+     * never shrinks */
+    float min_load;
+    /* a bit per slot of the array, set when it holds a key; only with
+     * HASHMAPQ_OCCUPANCY_BITMAP */
+    unsigned long long *occupied;
+    /* the file behind a HASHMAPQ_MAPPED map */
+    void *mapping;
+    /* set while hashmapq_journal_start() is in effect */
+    void *journal;
+    /* used instead of hash by maps from hashmapq_new_seeded() */
+    func_seeded_hash_f seeded_hash;
+    unsigned long seed;
+    /* steps the last insert probed */
+    int probes;
+    /* the array size at the last reseed; a map reseeds once per size */
+    int reseed_size;
+    func_flood_f on_flood;
+    void *flood_udata;
 } hashmapq_t;
 
+/* turns the bytes hashmapq_journal_start()'s serializers wrote back into
+ * keys and vals for hashmapq_recover() */
+typedef struct
+{
+    /* @return a key made from len bytes at buf; NULL reads the bytes back
+     *  as the key pointer's value */
+    void *(*key) (const void *buf, size_t len);
+    /* as key, for vals */
+    void *(*val) (const void *buf, size_t len);
+    /* frees a key or val that recovery made but the map didn't keep, eg. a
+     * val a later put replaced. May be NULL */
+    void (*release) (void *item);
+} hashmapq_deserializer_t;
+
 typedef struct
 {
     int cur;
+    /* where a HASHMAPQ_ROBIN_HOOD walk began */
+    int start;
+    /* the array being walked with HASHMAPQ_CONCURRENT_READS */
+    void *table;
 } hashmapq_iterator_t;
 
+/**
+ * Hash len bytes with wyhash.
+ * @param seed picks one of a family of unrelated hashes */
+unsigned long hashmapq_hash_bytes(
+    const void *key,
+    size_t len,
+    unsigned long seed
+);
+
+/**
+ * A func_longhash_f for NUL terminated strings */
+unsigned long hashmapq_hash_str(
+    const void *key
+);
+
+/**
+ * A func_longhash_f for keys that are pointers, or integers cast to them.
+ * Hashes the pointer itself, not what it points to */
+unsigned long hashmapq_hash_ptr(
+    const void *key
+);
+
+/**
+ * hashmapq_hash_str() under a seed; a func_seeded_hash_f */
+unsigned long hashmapq_hash_str_seeded(
+    const void *key,
+    unsigned long seed
+);
+
+/**
+ * hashmapq_hash_ptr() under a seed; a func_seeded_hash_f */
+unsigned long hashmapq_hash_ptr_seeded(
+    const void *key,
+    unsigned long seed
+);
+
+/**
+ * Spread a weak hash's entropy over all of its bits with a
+ * multiply-xorshift finalizer. See HASHMAPQ_MIX_HASH */
+unsigned long hashmapq_mix(
+    unsigned long hash
+);
+
+/**
+ * Create a new hashmap.
+ * @param hash may be NULL if every call uses the _with_hash variants. The
+ *  map then keeps its own copy of each hash (HASHMAPQ_STORE_HASH) */
 hashmapq_t *hashmapq_new(
     func_longhash_f hash,
     func_longcmp_f cmp,
     unsigned int initial_capacity
 );
 
+/**
+ * Create a new hashmap with behaviour modified by flags.
+ * @param flags HASHMAPQ_* flags OR'd together */
+hashmapq_t *hashmapq_new_with_flags(
+    func_longhash_f hash,
+    func_longcmp_f cmp,
+    unsigned int initial_capacity,
+    int flags
+);
+
+/**
+ * Create a new hashmap that gets all of its memory, including the
+ * hashmapq_t itself, from allocator.
+ * @param allocator copied into the map; NULL for malloc and free */
+hashmapq_t *hashmapq_new_with_allocator(
+    func_longhash_f hash,
+    func_longcmp_f cmp,
+    unsigned int initial_capacity,
+    int flags,
+    const hashmapq_allocator_t * allocator
+);
+
+/**
+ * Create a new hashmap that trades memory for speed its own way.
+ * @param max_load grow once this fraction of the slots are used. Lower is
+ *  faster, higher is smaller. The default is 0.5, or 0.875 with
+ *  HASHMAPQ_ROBIN_HOOD. At most 0.75 without HASHMAPQ_ROBIN_HOOD
+ * @param min_load once a remove takes the count below this fraction of the
+ *  slots, the array is halved; never below initial_capacity. Under half of
+ *  max_load; 0 never shrinks. Don't remove while iterating a map that
+ *  shrinks */
+hashmapq_t *hashmapq_new_with_load_factors(
+    func_longhash_f hash,
+    func_longcmp_f cmp,
+    unsigned int initial_capacity,
+    int flags,
+    float max_load,
+    float min_load
+);
+
+/**
+ * @param capacity number of slots, a power of two. At most half of them
+ *  hold keys (all but one eighth with HASHMAPQ_ROBIN_HOOD)
+ * @param flags as given to hashmapq_init_in_buffer(). Include
+ *  HASHMAPQ_STORE_HASH if there won't be a hash callback
+ * @return bytes of buffer hashmapq_init_in_buffer() needs */
+size_t hashmapq_buffer_size(
+    unsigned int capacity,
+    int flags
+);
+
+/**
+ * Initialise a map that keeps everything in h and buffer, and never
+ * allocates. It can't grow; once full, puts of new keys fail with
+ * HASHMAPQ_FULL. Releasing h and buffer releases the map; there is no need
+ * to call hashmapq_free().
+ * @param buffer hashmapq_buffer_size() bytes, aligned for a pointer */
+void hashmapq_init_in_buffer(
+    hashmapq_t * h,
+    func_longhash_f hash,
+    func_longcmp_f cmp,
+    unsigned int capacity,
+    int flags,
+    void *buffer
+);
+
+/**
+ * Create a map for keys an attacker may choose, eg. strings from requests.
+ * Keys are hashed under a random seed, so colliding keys can't be worked
+ * out ahead of time. A put that probes suspiciously far picks a new seed
+ * and rehashes everything, at most once per array size.
+ * Can't be combined with HASHMAPQ_CONCURRENT_READS or HASHMAPQ_LOCK_FREE.
+ * Callers can't know the seed, so the _with_hash variants can't be used.
+ * @param hash should mix the seed in throughout, as
+ *  hashmapq_hash_str_seeded() does */
+hashmapq_t *hashmapq_new_seeded(
+    func_seeded_hash_f hash,
+    func_longcmp_f cmp,
+    unsigned int initial_capacity,
+    int flags
+);
+
+/**
+ * Have fn called whenever a put probes suspiciously far, eg. to raise an
+ * alert. A map from hashmapq_new_seeded() has already reseeded by then.
+ * fn must not change the map.
+ * @param udata passed through to fn */
+void hashmapq_set_flood_callback(
+    hashmapq_t * hmap,
+    func_flood_f fn,
+    void *udata
+);
+
+/**
+ * Write the map to fd, from offset 0, in a form hashmapq_open_mmap() can
+ * use as it is. Tombstones are left out. The file is only readable on
+ * machines with the same byte order and pointer size. Maps from
+ * hashmapq_new_seeded() can't be saved, as a mapped map has no seed to
+ * hash with.
+ * @param key_serializer writes a key's bytes into the file. Gets on the
+ *  mapped map pass compare a pointer to those bytes, so they should look
+ *  like a key to compare. NULL stores the key pointers' values as they are,
+ *  for maps of integers
+ * @param val_serializer as key_serializer, for vals
+ * @return 0 on success, otherwise -1 with errno set */
+int hashmapq_save(
+    hashmapq_t * hmap,
+    int fd,
+    func_serialize_f key_serializer,
+    func_serialize_f val_serializer
+);
+
+/**
+ * Map a file written by hashmapq_save() and look keys up in it in place;
+ * nothing is read until a get touches it. Only gets, count and size work
+ * on the map. hashmapq_freeall() unmaps it.
+ * @param hash,cmp the callbacks the saved map used. Vals that were
+ *  serialized come back as pointers to their bytes in the file
+ * @return the map, or NULL with errno set if the file can't be used */
+hashmapq_t *hashmapq_open_mmap(
+    const char *path,
+    func_longhash_f hash,
+    func_longcmp_f cmp
+);
+
+/**
+ * Checksum the whole of a mapped file. hashmapq_open_mmap() only checks
+ * the header, so opening stays instant.
+ * @return 1 if the file is intact, otherwise 0 */
+int hashmapq_verify_mmap(
+    const hashmapq_t * hmap
+);
+
+/**
+ * Log every put, remove and clear to journal_fd from now on, so that
+ * hashmapq_recover() can rebuild the map after a crash. Records are
+ * buffered until hashmapq_journal_commit(). Vals changed in place through
+ * hashmapq_get_or_put()'s pointer aren't logged; only the next checkpoint
+ * captures them.
+ * @param journal_fd an empty file, or one hashmapq_recover() has just read
+ * @param checkpoint_fd where hashmapq_checkpoint() appends
+ * @param key_serializer writes a key's bytes into the logs. NULL logs the
+ *  key pointers' values as they are, for maps of integers
+ * @param val_serializer as key_serializer, for vals */
+void hashmapq_journal_start(
+    hashmapq_t * hmap,
+    int journal_fd,
+    int checkpoint_fd,
+    func_serialize_f key_serializer,
+    func_serialize_f val_serializer
+);
+
+/**
+ * Write out and fdatasync every record logged since the last commit.
+ * Committing after a batch of changes rather than after each one pays for
+ * the sync once.
+ * @return 0 once the records are durable, otherwise -1 */
+int hashmapq_journal_commit(
+    hashmapq_t * hmap
+);
+
+/**
+ * Append the slot pages that changed since the last checkpoint to the
+ * checkpoint file, then empty the journal. The first checkpoint, and the
+ * first after a resize or clear, writes every page. The checkpoint file
+ * only grows; start a new one with a fresh journal to compact it.
+ * @return 0 on success, otherwise -1 */
+int hashmapq_checkpoint(
+    hashmapq_t * hmap
+);
+
+/**
+ * Commit and stop journaling. hashmapq_freeall() does this too.
+ * @return hashmapq_journal_commit()'s result */
+int hashmapq_journal_stop(
+    hashmapq_t * hmap
+);
+
+/**
+ * Rebuild an empty map from the last complete checkpoint and the journal
+ * records after it. A torn record at the end of either file, from a crash
+ * mid-write, ends that file and is cut off.
+ * @param deserializer reads back what the serializers wrote. NULL reads
+ *  keys and vals as pointer values
+ * @return 0 on success, otherwise -1 */
+int hashmapq_recover(
+    hashmapq_t * hmap,
+    int journal_fd,
+    int checkpoint_fd,
+    const hashmapq_deserializer_t * deserializer
+);
+
 /**
  * @return number of items within hash */
 int hashmapq_count(const hashmapq_t * hmap);
@@ -70,6 +472,29 @@ void *hashmapq_get(
     const void *key
 );
 
+/**
+ * Get this key's value, using a hash the caller already has.
+ * The hash must be what the map's hash callback would return for key.
+ * @return key's item, otherwise NULL */
+void *hashmapq_get_with_hash(
+    hashmapq_t * hmap,
+    const void *key,
+    unsigned long hash
+);
+
+/**
+ * Get the values of a batch of keys.
+ * The whole batch is hashed and its first probe slots are prefetched before
+ * any key is resolved, so cache misses overlap instead of stalling one at a
+ * time.
+ * @param vals receives each key's item, otherwise NULL */
+void hashmapq_get_batch(
+    hashmapq_t * hmap,
+    void **keys,
+    int nkeys,
+    void **vals
+);
+
 /**
  * Is this key inside this map?
  * @return 1 if key is in hash, otherwise 0 */
@@ -78,6 +503,15 @@ int hashmapq_contains_key(
     const void *key
 );
 
+/**
+ * Is this key inside this map? See hashmapq_get_with_hash().
+ * @return 1 if key is in hash, otherwise 0 */
+int hashmapq_contains_key_with_hash(
+    hashmapq_t * hmap,
+    const void *key,
+    unsigned long hash
+);
+
 /**
  * Remove the value refrenced by this key from the hash. */
 void hashmapq_remove_entry(
@@ -94,16 +528,98 @@ void *hashmapq_remove(
     const void *key
 );
 
+/**
+ * Remove this key and value from the map. See hashmapq_get_with_hash().
+ * @return value of key, or NULL on failure */
+void *hashmapq_remove_with_hash(
+    hashmapq_t * hmap,
+    const void *key,
+    unsigned long hash
+);
+
 /**
  * Associate key with val.
  * Does not insert key if an equal key exists.
- * @return previous associated val; otherwise NULL */
+ * @return previous associated val; HASHMAPQ_FULL if the map is
+ *  HASHMAPQ_FIXED and has no room for key; otherwise NULL */
 void *hashmapq_put(
     hashmapq_t * hmap,
     void *key,
     void *val
 );
 
+/**
+ * Associate key with val. See hashmapq_get_with_hash().
+ * @return previous associated val; HASHMAPQ_FULL if the map is
+ *  HASHMAPQ_FIXED and has no room for key; otherwise NULL */
+void *hashmapq_put_with_hash(
+    hashmapq_t * hmap,
+    void *key,
+    void *val,
+    unsigned long hash
+);
+
+/**
+ * Get key's value, inserting key with val first if it isn't in the map.
+ * Only probes once, so "increment or insert 1" costs a single lookup.
+ * @param inserted if not NULL, set to 1 if key was inserted, otherwise 0
+ * @return pointer to key's value, valid until the map is next modified;
+ *  NULL if key or val is NULL, or a HASHMAPQ_FIXED map is full */
+void **hashmapq_get_or_put(
+    hashmapq_t * hmap,
+    void *key,
+    void *val,
+    int *inserted
+);
+
+/**
+ * Associate a batch of keys with their vals, prefetching like
+ * hashmapq_get_batch().
+ * @param old_vals if not NULL, receives each key's previous val, or NULL.
+ *  A HASHMAPQ_FIXED map with no room for a key gives HASHMAPQ_FULL, which
+ *  is not a val */
+void hashmapq_put_batch(
+    hashmapq_t * hmap,
+    void **keys,
+    void **vals,
+    int nkeys,
+    void **old_vals
+);
+
+/**
+ * Make room for n keys in total, resizing at most once, so the puts that
+ * follow never have to. Not for HASHMAPQ_FIXED or HASHMAPQ_LOCK_FREE maps */
+void hashmapq_reserve(
+    hashmapq_t * hmap,
+    int n
+);
+
+/**
+ * Put n entries into the map, like put. The map is reserved for them up
+ * front, then they are inserted with no capacity checks and with their
+ * first probe slots prefetched like hashmapq_get_batch().
+ * Entries with a NULL key or val are skipped; with duplicate keys the last
+ * entry's val wins. A HASHMAPQ_FIXED map can't be reserved: once it is
+ * full, entries with new keys are dropped, so check hashmapq_count(). */
+void hashmapq_build(
+    hashmapq_t * hmap,
+    const hash_entry_t * entries,
+    int n
+);
+
+/**
+ * hashmapq_build() with the puts split between nthreads threads, which
+ * claim empty slots with compare-and-swap. The hash and compare callbacks
+ * must be safe to call from several threads at once. Which val wins for
+ * duplicate keys is unspecified. Robin Hood, concurrent, lock-free and
+ * fixed maps build on the calling thread. */
+void hashmapq_build_parallel(
+    hashmapq_t * hmap,
+    const hash_entry_t * entries,
+    int n,
+    int nthreads
+);
+
 /**
  * Put this key/value entry into the hash */
 void hashmapq_put_entry(
@@ -124,6 +640,15 @@ int hashmapq_iterator_has_next(
     hashmapq_iterator_t * iter
 );
 
+/**
+ * Iterate to the next item on a hash iterator
+ * @param entry receives the item's key and val
+ * @return 1 if there was an item, otherwise 0 */
+int hashmapq_iterator_next_entry(
+    hashmapq_t * h,
+    hashmapq_iterator_t * iter,
+    hash_entry_t * entry);
+
 /**
  * Iterate to the next item on a hash iterator
  * @return next item key from iterator */
@@ -141,14 +666,64 @@ void *hashmapq_iterator_next_value(
 
 /**
  * Initialise a new hash iterator over this hash
- * It is safe to remove items while iterating.  */
+ * It is safe to remove items while iterating, unless the map was given a
+ * min load factor. With HASHMAPQ_ROBIN_HOOD, only remove the key the
+ * iterator just returned; removing any other key shifts entries back, so
+ * some may be skipped or returned twice.
+ * Finishes any incremental resize that is in progress. */
 void hashmapq_iterator(
     hashmapq_t * hmap,
     hashmapq_iterator_t * iter
 );
 
 /**
- * Increase hash capacity. */
+ * Call cb with each key and val in the map, in no particular order.
+ * Faster than an iterator: with HASHMAPQ_OCCUPANCY_BITMAP only occupied
+ * slots are looked at. cb must not put into or remove from the map.
+ * @return the first non-zero value cb returned, otherwise 0 */
+int hashmapq_for_each(
+    hashmapq_t * hmap,
+    func_visit_f cb,
+    void *udata
+);
+
+/**
+ * Increase hash capacity. Not for HASHMAPQ_FIXED maps. */
 void hashmapq_increase_capacity(hashmapq_t * hmap);
 
+/**
+ * hashmapq_increase_capacity() with the old array's slots split between
+ * nthreads threads. Robin Hood, concurrent and lock-free maps resize on the
+ * calling thread. */
+void hashmapq_increase_capacity_parallel(
+    hashmapq_t * hmap,
+    int nthreads
+);
+
+/**
+ * Remove all tombstones left behind by removes, without resizing.
+ * Useful for shortening probe chains during quiet periods. */
+void hashmapq_compact(hashmapq_t * hmap);
+
+/**
+ * Enter a read section of a HASHMAPQ_CONCURRENT_READS map.
+ * Gets enter one on their own. Readers that iterate must hold one from
+ * hashmapq_iterator() until they are done with the iterator, and the keys
+ * and values it returned. The writer must not enter one.
+ * @return token to pass to hashmapq_read_end() */
+int hashmapq_read_begin(
+    hashmapq_t * h
+);
+
+/**
+ * Leave a read section entered with hashmapq_read_begin(). */
+void hashmapq_read_end(
+    hashmapq_t * h,
+    int token
+);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* QUADRATIC_PROBING_HASHMAP_H */
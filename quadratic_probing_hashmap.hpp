@@ -0,0 +1,574 @@
+#ifndef QUADRATIC_PROBING_HASHMAP_HPP
+#define QUADRATIC_PROBING_HASHMAP_HPP
+
+/**
+ * Header-only C++ front-end to the quadratic probing hashmap.
+ *
+ * This uses the same probe sequence, tombstones and SPACERATIO as
+ * quadratic_probing_hashmap.c. Keys and values are stored inline in the
+ * slots, and the hash and equality functors are inlined instead of being
+ * called through function pointers. Requires C++17. */
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace qph {
+
+namespace detail {
+
+template <class T, class = void>
+struct is_transparent : std::false_type {};
+
+template <class T>
+struct is_transparent<T, std::void_t<typename T::is_transparent>>
+    : std::true_type {};
+
+} // namespace detail
+
+template <class K,
+          class V,
+          class Hash = std::hash<K>,
+          class Eq = std::equal_to<K>,
+          class Alloc = std::allocator<std::pair<const K, V>>>
+class HashMap
+{
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<const K, V>;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using hasher = Hash;
+    using key_equal = Eq;
+    using allocator_type = Alloc;
+    using reference = value_type &;
+    using const_reference = const value_type &;
+
+private:
+    enum : unsigned char { EMPTY = 0, FULL = 1, TOMBSTONE = 2 };
+
+    /* value_type has a const key, so rehashing moves entries through the
+     * mutable view of the same storage */
+    union slot_type
+    {
+        slot_type() {}
+        ~slot_type() {}
+        value_type value;
+        std::pair<K, V> mutable_value;
+    };
+
+    using alloc_traits = std::allocator_traits<Alloc>;
+    using slot_alloc_type =
+        typename alloc_traits::template rebind_alloc<slot_type>;
+    using slot_traits = std::allocator_traits<slot_alloc_type>;
+    using ctrl_alloc_type =
+        typename alloc_traits::template rebind_alloc<unsigned char>;
+    using ctrl_traits = std::allocator_traits<ctrl_alloc_type>;
+
+    static constexpr size_type initial_capacity = 8;
+
+public:
+    template <bool Const>
+    class iterator_base
+    {
+        friend class HashMap;
+        using map_ptr = std::conditional_t<Const, const HashMap *, HashMap *>;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = typename HashMap::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference =
+            std::conditional_t<Const, const value_type &, value_type &>;
+        using pointer =
+            std::conditional_t<Const, const value_type *, value_type *>;
+
+        iterator_base() = default;
+
+        /* iterator converts to const_iterator */
+        template <bool C = Const, class = std::enable_if_t<C>>
+        iterator_base(const iterator_base<false> &o)
+            : map_(o.map_), idx_(o.idx_) {}
+
+        reference operator*() const { return map_->slots_[idx_].value; }
+        pointer operator->() const { return &map_->slots_[idx_].value; }
+
+        iterator_base &operator++()
+        {
+            idx_ = map_->next_full(idx_ + 1);
+            return *this;
+        }
+
+        iterator_base operator++(int)
+        {
+            iterator_base tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        friend bool operator==(const iterator_base &a, const iterator_base &b)
+        {
+            return a.idx_ == b.idx_;
+        }
+
+        friend bool operator!=(const iterator_base &a, const iterator_base &b)
+        {
+            return a.idx_ != b.idx_;
+        }
+
+    private:
+        template <bool> friend class iterator_base;
+
+        iterator_base(map_ptr map, size_type idx) : map_(map), idx_(idx) {}
+
+        map_ptr map_ = nullptr;
+        size_type idx_ = 0;
+    };
+
+    using iterator = iterator_base<false>;
+    using const_iterator = iterator_base<true>;
+
+private:
+    /* lookups with other key types only when both functors opt in;
+     * iterators are left to erase(const_iterator) */
+    template <class Q>
+    using enable_if_transparent_t = std::enable_if_t<
+        detail::is_transparent<Hash>::value &&
+        detail::is_transparent<Eq>::value &&
+        !std::is_convertible<const Q &, iterator>::value &&
+        !std::is_convertible<const Q &, const_iterator>::value, Q>;
+
+public:
+
+    HashMap() = default;
+
+    explicit HashMap(size_type capacity,
+                     const Hash &hash = Hash(),
+                     const Eq &eq = Eq(),
+                     const Alloc &alloc = Alloc())
+        : hash_(hash), eq_(eq), slot_alloc_(alloc), ctrl_alloc_(alloc)
+    {
+        reserve(capacity);
+    }
+
+    HashMap(const HashMap &o)
+        : hash_(o.hash_), eq_(o.eq_),
+          slot_alloc_(slot_traits::select_on_container_copy_construction(
+              o.slot_alloc_)),
+          ctrl_alloc_(ctrl_traits::select_on_container_copy_construction(
+              o.ctrl_alloc_))
+    {
+        reserve(o.count_);
+        for (const auto &e : o)
+            try_emplace(e.first, e.second);
+    }
+
+    HashMap(HashMap &&o) noexcept
+        : slots_(o.slots_), ctrl_(o.ctrl_), size_(o.size_),
+          count_(o.count_), used_(o.used_),
+          hash_(std::move(o.hash_)), eq_(std::move(o.eq_)),
+          slot_alloc_(std::move(o.slot_alloc_)),
+          ctrl_alloc_(std::move(o.ctrl_alloc_))
+    {
+        o.slots_ = nullptr;
+        o.ctrl_ = nullptr;
+        o.size_ = o.count_ = o.used_ = 0;
+    }
+
+    HashMap &operator=(const HashMap &o)
+    {
+        if (this != &o)
+        {
+            HashMap tmp(o);
+            swap(tmp);
+        }
+        return *this;
+    }
+
+    HashMap &operator=(HashMap &&o) noexcept
+    {
+        if (this != &o)
+        {
+            destroy();
+            slots_ = o.slots_;
+            ctrl_ = o.ctrl_;
+            size_ = o.size_;
+            count_ = o.count_;
+            used_ = o.used_;
+            hash_ = std::move(o.hash_);
+            eq_ = std::move(o.eq_);
+            slot_alloc_ = std::move(o.slot_alloc_);
+            ctrl_alloc_ = std::move(o.ctrl_alloc_);
+            o.slots_ = nullptr;
+            o.ctrl_ = nullptr;
+            o.size_ = o.count_ = o.used_ = 0;
+        }
+        return *this;
+    }
+
+    ~HashMap() { destroy(); }
+
+    void swap(HashMap &o) noexcept
+    {
+        using std::swap;
+        swap(slots_, o.slots_);
+        swap(ctrl_, o.ctrl_);
+        swap(size_, o.size_);
+        swap(count_, o.count_);
+        swap(used_, o.used_);
+        swap(hash_, o.hash_);
+        swap(eq_, o.eq_);
+        swap(slot_alloc_, o.slot_alloc_);
+        swap(ctrl_alloc_, o.ctrl_alloc_);
+    }
+
+    iterator begin() { return iterator(this, next_full(0)); }
+    iterator end() { return iterator(this, size_); }
+    const_iterator begin() const { return const_iterator(this, next_full(0)); }
+    const_iterator end() const { return const_iterator(this, size_); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    /** @return number of items within the map */
+    size_type size() const { return count_; }
+    bool empty() const { return 0 == count_; }
+
+    /** @return size of the slot array */
+    size_type capacity() const { return size_; }
+
+    /**
+     * Empty this map. Keeps the slot array. */
+    void clear()
+    {
+        for (size_type i = 0; i < size_; i++)
+        {
+            if (ctrl_[i] == FULL)
+                destroy_slot(i);
+            ctrl_[i] = EMPTY;
+        }
+        count_ = used_ = 0;
+    }
+
+    /**
+     * Size the slot array so n items fit without growing. */
+    void reserve(size_type n)
+    {
+        size_type want = initial_capacity;
+
+        while (want * SPACERATIO_NUM < n * SPACERATIO_DEN)
+            want <<= 1;
+        if (want > size_)
+            rehash(want);
+    }
+
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(const K &key, Args &&... args)
+    {
+        return try_emplace_impl(key, std::forward<Args>(args)...);
+    }
+
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(K &&key, Args &&... args)
+    {
+        return try_emplace_impl(std::move(key), std::forward<Args>(args)...);
+    }
+
+    /**
+     * Does not insert if an equal key exists; the arguments are still
+     * consumed to build the key. */
+    template <class... Args>
+    std::pair<iterator, bool> emplace(Args &&... args)
+    {
+        std::pair<K, V> tmp(std::forward<Args>(args)...);
+
+        return try_emplace_impl(std::move(tmp.first), std::move(tmp.second));
+    }
+
+    std::pair<iterator, bool> insert(const value_type &v)
+    {
+        return try_emplace_impl(v.first, v.second);
+    }
+
+    std::pair<iterator, bool> insert(value_type &&v)
+    {
+        return try_emplace_impl(v.first, std::move(v.second));
+    }
+
+    template <class M>
+    std::pair<iterator, bool> insert_or_assign(const K &key, M &&m)
+    {
+        auto r = try_emplace_impl(key, std::forward<M>(m));
+        if (!r.second)
+            r.first->second = std::forward<M>(m);
+        return r;
+    }
+
+    template <class M>
+    std::pair<iterator, bool> insert_or_assign(K &&key, M &&m)
+    {
+        auto r = try_emplace_impl(std::move(key), std::forward<M>(m));
+        if (!r.second)
+            r.first->second = std::forward<M>(m);
+        return r;
+    }
+
+    V &operator[](const K &key) { return try_emplace_impl(key).first->second; }
+    V &operator[](K &&key)
+    {
+        return try_emplace_impl(std::move(key)).first->second;
+    }
+
+    V &at(const K &key)
+    {
+        iterator it = find(key);
+        if (it == end())
+            throw std::out_of_range("qph::HashMap::at");
+        return it->second;
+    }
+
+    const V &at(const K &key) const
+    {
+        const_iterator it = find(key);
+        if (it == end())
+            throw std::out_of_range("qph::HashMap::at");
+        return it->second;
+    }
+
+    iterator find(const K &key) { return iterator(this, find_index(key)); }
+    const_iterator find(const K &key) const
+    {
+        return const_iterator(this, find_index(key));
+    }
+
+    template <class Q, class = enable_if_transparent_t<Q>>
+    iterator find(const Q &key) { return iterator(this, find_index(key)); }
+
+    template <class Q, class = enable_if_transparent_t<Q>>
+    const_iterator find(const Q &key) const
+    {
+        return const_iterator(this, find_index(key));
+    }
+
+    bool contains(const K &key) const { return find_index(key) != size_; }
+
+    template <class Q, class = enable_if_transparent_t<Q>>
+    bool contains(const Q &key) const { return find_index(key) != size_; }
+
+    size_type count(const K &key) const { return contains(key) ? 1 : 0; }
+
+    template <class Q, class = enable_if_transparent_t<Q>>
+    size_type count(const Q &key) const { return contains(key) ? 1 : 0; }
+
+    /**
+     * Remove this key from the map.
+     * @return number of items removed */
+    size_type erase(const K &key) { return erase_impl(key); }
+
+    template <class Q, class = enable_if_transparent_t<Q>>
+    size_type erase(const Q &key) { return erase_impl(key); }
+
+    /**
+     * Remove the item at pos. It is safe to erase while iterating.
+     * @return iterator to the next item */
+    iterator erase(const_iterator pos)
+    {
+        size_type idx = pos.idx_;
+
+        destroy_slot(idx);
+        ctrl_[idx] = TOMBSTONE;
+        count_--;
+        return iterator(this, next_full(idx + 1));
+    }
+
+    hasher hash_function() const { return hash_; }
+    key_equal key_eq() const { return eq_; }
+
+private:
+    /* SPACERATIO of quadratic_probing_hashmap.c, as a fraction */
+    static constexpr size_type SPACERATIO_NUM = 1;
+    static constexpr size_type SPACERATIO_DEN = 2;
+
+    /** @return array index of the i-th step of the probe sequence */
+    size_type probe(size_type hash, size_type i) const
+    {
+        return (hash + (i / 2) + (i * i) / 2) & (size_ - 1);
+    }
+
+    size_type next_full(size_type idx) const
+    {
+        while (idx < size_ && ctrl_[idx] != FULL)
+            idx++;
+        return idx;
+    }
+
+    /** @return array index of key, otherwise size_ */
+    template <class Q>
+    size_type find_index(const Q &key) const
+    {
+        if (0 == count_)
+            return size_;
+        return find_index(key, hash_(key));
+    }
+
+    template <class Q>
+    size_type find_index(const Q &key, size_type hash) const
+    {
+        if (0 == count_)
+            return size_;
+
+        for (size_type i = 0;; i++)
+        {
+            size_type idx = probe(hash, i);
+
+            if (ctrl_[idx] == EMPTY)
+                return size_;
+            if (ctrl_[idx] == FULL && eq_(slots_[idx].value.first, key))
+                return idx;
+        }
+    }
+
+    template <class KK, class... Args>
+    std::pair<iterator, bool> try_emplace_impl(KK &&key, Args &&... args)
+    {
+        size_type hash = hash_(key);
+        size_type idx = find_index(key, hash);
+
+        if (idx != size_)
+            return {iterator(this, idx), false};
+
+        /* only an insert may grow the table */
+        ensure_capacity();
+
+        /* the key is absent, so the first tombstone or empty slot will do */
+        for (size_type i = 0;; i++)
+        {
+            idx = probe(hash, i);
+            if (ctrl_[idx] != FULL)
+                break;
+        }
+
+        slot_traits::construct(
+            slot_alloc_, &slots_[idx].mutable_value,
+            std::piecewise_construct,
+            std::forward_as_tuple(std::forward<KK>(key)),
+            std::forward_as_tuple(std::forward<Args>(args)...));
+
+        if (ctrl_[idx] == EMPTY)
+            used_++;
+        ctrl_[idx] = FULL;
+        count_++;
+        return {iterator(this, idx), true};
+    }
+
+    template <class Q>
+    size_type erase_impl(const Q &key)
+    {
+        size_type idx = find_index(key);
+
+        if (idx == size_)
+            return 0;
+
+        destroy_slot(idx);
+        ctrl_[idx] = TOMBSTONE;
+        count_--;
+        return 1;
+    }
+
+    void ensure_capacity()
+    {
+        if (used_ * SPACERATIO_DEN < size_ * SPACERATIO_NUM)
+            return;
+
+        /* tombstones filled us up; there's no need to grow */
+        if (count_ * SPACERATIO_DEN * 2 < size_ * SPACERATIO_NUM)
+            rehash(size_);
+        else
+            rehash(size_ ? size_ << 1 : initial_capacity);
+    }
+
+    void rehash(size_type new_size)
+    {
+        slot_type *slots_old = slots_;
+        unsigned char *ctrl_old = ctrl_;
+        size_type size_old = size_;
+
+        slots_ = slot_traits::allocate(slot_alloc_, new_size);
+        ctrl_ = ctrl_traits::allocate(ctrl_alloc_, new_size);
+        std::fill(ctrl_, ctrl_ + new_size, (unsigned char) EMPTY);
+        size_ = new_size;
+        used_ = count_;
+
+        for (size_type ii = 0; ii < size_old; ii++)
+        {
+            if (ctrl_old[ii] != FULL)
+                continue;
+
+            std::pair<K, V> &e = slots_old[ii].mutable_value;
+            size_type hash = hash_(e.first);
+
+            for (size_type i = 0;; i++)
+            {
+                size_type idx = probe(hash, i);
+
+                if (ctrl_[idx] == EMPTY)
+                {
+                    slot_traits::construct(slot_alloc_,
+                                           &slots_[idx].mutable_value,
+                                           std::move(e));
+                    ctrl_[idx] = FULL;
+                    break;
+                }
+            }
+
+            slot_traits::destroy(slot_alloc_, &e);
+        }
+
+        if (slots_old)
+        {
+            slot_traits::deallocate(slot_alloc_, slots_old, size_old);
+            ctrl_traits::deallocate(ctrl_alloc_, ctrl_old, size_old);
+        }
+    }
+
+    void destroy_slot(size_type idx)
+    {
+        slot_traits::destroy(slot_alloc_, &slots_[idx].mutable_value);
+    }
+
+    void destroy()
+    {
+        if (!slots_)
+            return;
+        clear();
+        slot_traits::deallocate(slot_alloc_, slots_, size_);
+        ctrl_traits::deallocate(ctrl_alloc_, ctrl_, size_);
+        slots_ = nullptr;
+        ctrl_ = nullptr;
+        size_ = 0;
+    }
+
+    slot_type *slots_ = nullptr;
+    unsigned char *ctrl_ = nullptr;
+    /* size of the array */
+    size_type size_ = 0;
+    /* number of items within the map */
+    size_type count_ = 0;
+    /* this is inclusive of tombstones */
+    size_type used_ = 0;
+    Hash hash_;
+    Eq eq_;
+    slot_alloc_type slot_alloc_;
+    ctrl_alloc_type ctrl_alloc_;
+};
+
+} // namespace qph
+
+#endif /* QUADRATIC_PROBING_HASHMAP_HPP */
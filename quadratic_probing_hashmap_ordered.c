@@ -0,0 +1,388 @@
+/*
+ 
+Copyright (c) 2011, Willem-Hendrik Thiart
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * The names of its contributors may not be used to endorse or promote
+      products derived from this software without specific prior written
+      permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL WILLEM-HENDRIK THIART BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "quadratic_probing_hashmap_ordered.h"
+
+/* when we call for more capacity */
+#define SPACERATIO 0.5
+
+/* index table values that aren't entry indices */
+#define IX_EMPTY -1
+#define IX_DUMMY -2
+
+/**
+ * @return bytes per slot of an index table of this size. Indices never go
+ *  past size * SPACERATIO */
+static int __ix_width(
+    int size
+)
+{
+    if (size <= 0x100)
+        return 1;
+    if (size <= 0x10000)
+        return 2;
+    return 4;
+}
+
+static int __ix_get(
+    const hashmapq_ordered_t * h,
+    unsigned int slot
+)
+{
+    switch (__ix_width(h->size))
+    {
+    case 1:
+        return ((signed char *) h->indices)[slot];
+    case 2:
+        return ((short *) h->indices)[slot];
+    default:
+        return ((int *) h->indices)[slot];
+    }
+}
+
+static void __ix_set(
+    hashmapq_ordered_t * h,
+    unsigned int slot,
+    int ix
+)
+{
+    switch (__ix_width(h->size))
+    {
+    case 1:
+        ((signed char *) h->indices)[slot] = ix;
+        break;
+    case 2:
+        ((short *) h->indices)[slot] = ix;
+        break;
+    default:
+        ((int *) h->indices)[slot] = ix;
+    }
+}
+
+/**
+ * @return number of entries the arrays have room for */
+static int __capacity(
+    int size
+)
+{
+    return size * SPACERATIO;
+}
+
+static unsigned int __probe(
+    const hashmapq_ordered_t * h,
+    unsigned long hash,
+    unsigned int i
+)
+{
+    return (hash + (i/2) + (i * i)/2) & (h->size - 1);
+}
+
+/**
+ * Every slot of the index table reads as IX_EMPTY when all its bytes are
+ * 0xff, whatever the width */
+static void __alloc_indices(
+    hashmapq_ordered_t * h,
+    int size
+)
+{
+    h->size = size;
+    h->indices = malloc(size * __ix_width(size));
+    memset(h->indices, 0xff, size * __ix_width(size));
+}
+
+hashmapq_ordered_t *hashmapq_ordered_new(
+    func_longhash_f hash,
+    func_longcmp_f cmp,
+    unsigned int initial_capacity
+)
+{
+    hashmapq_ordered_t *h;
+
+    assert(initial_capacity && !(initial_capacity & (initial_capacity - 1)));
+
+    h = calloc(1, sizeof(hashmapq_ordered_t));
+    __alloc_indices(h, initial_capacity < 2 ? 2 : initial_capacity);
+    h->entries = malloc(__capacity(h->size) *
+                        sizeof(hashmapq_ordered_entry_t));
+    h->hash = hash;
+    h->compare = cmp;
+    return h;
+}
+
+int hashmapq_ordered_count(const hashmapq_ordered_t * h)
+{
+    return h->count;
+}
+
+int hashmapq_ordered_size(const hashmapq_ordered_t * h)
+{
+    return h->size;
+}
+
+void hashmapq_ordered_clear(hashmapq_ordered_t * h)
+{
+    memset(h->indices, 0xff, h->size * __ix_width(h->size));
+    h->count = 0;
+    h->nentries = 0;
+}
+
+void hashmapq_ordered_freeall(hashmapq_ordered_t * h)
+{
+    assert(h);
+    free(h->indices);
+    free(h->entries);
+    free(h);
+}
+
+/**
+ * @param slot if not NULL, receives the index table slot of key
+ * @return entry index of key, otherwise -1 */
+static int __find(
+    const hashmapq_ordered_t * h,
+    const void *key,
+    unsigned long hash,
+    unsigned int *slot
+)
+{
+    unsigned int i;
+
+    for (i=0; i < (unsigned int) h->size; i++)
+    {
+        unsigned int s = __probe(h, hash, i);
+        int ix = __ix_get(h, s);
+        const hashmapq_ordered_entry_t *e;
+
+        if (IX_EMPTY == ix)
+            return -1;
+        if (IX_DUMMY == ix)
+            continue;
+
+        /* the stored hash saves calling compare on most mismatches */
+        e = &h->entries[ix];
+        if (e->hash == hash && 0 == h->compare(key, e->key))
+        {
+            if (slot)
+                *slot = s;
+            return ix;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Point an empty slot of the index table at entry ix. */
+static void __place(
+    hashmapq_ordered_t * h,
+    unsigned long hash,
+    int ix
+)
+{
+    unsigned int i;
+
+    /* the load factor guarantees we will find an empty slot */
+    for (i=0;; i++)
+    {
+        unsigned int s = __probe(h, hash, i);
+
+        if (IX_EMPTY == __ix_get(h, s))
+        {
+            __ix_set(h, s, ix);
+            return;
+        }
+    }
+}
+
+/**
+ * Squeeze removed entries out and rebuild the index table at new_size.
+ * The stored hashes mean we never call the hash callback. */
+static void __rebuild(
+    hashmapq_ordered_t * h,
+    int new_size
+)
+{
+    int ii, n = 0;
+
+    for (ii = 0; ii < h->nentries; ii++)
+        if (h->entries[ii].key)
+            h->entries[n++] = h->entries[ii];
+    h->nentries = n;
+
+    if (new_size != h->size)
+        h->entries = realloc(h->entries, __capacity(new_size) *
+                             sizeof(hashmapq_ordered_entry_t));
+
+    free(h->indices);
+    __alloc_indices(h, new_size);
+
+    for (ii = 0; ii < h->nentries; ii++)
+        __place(h, h->entries[ii].hash, ii);
+}
+
+static void __ensurecapacity(hashmapq_ordered_t * h)
+{
+    if (h->nentries < __capacity(h->size))
+        return;
+
+    /* if removed entries are what filled us up, squeezing them out is
+     * enough */
+    if (h->count < __capacity(h->size) / 2)
+        __rebuild(h, h->size);
+    else
+        __rebuild(h, h->size << 1);
+}
+
+void *hashmapq_ordered_get(
+    hashmapq_ordered_t * h,
+    const void *key
+)
+{
+    int ix;
+
+    if (0 == h->count || !key)
+        return NULL;
+
+    ix = __find(h, key, h->hash(key), NULL);
+    return -1 == ix ? NULL : h->entries[ix].val;
+}
+
+int hashmapq_ordered_contains_key(
+    hashmapq_ordered_t * h,
+    const void *key
+)
+{
+    return NULL != hashmapq_ordered_get(h, key);
+}
+
+void *hashmapq_ordered_remove(
+    hashmapq_ordered_t * h,
+    const void *key
+)
+{
+    unsigned int slot;
+    int ix;
+
+    if (0 == h->count || !key)
+        return NULL;
+
+    ix = __find(h, key, h->hash(key), &slot);
+    if (-1 == ix)
+        return NULL;
+
+    __ix_set(h, slot, IX_DUMMY);
+    h->entries[ix].key = NULL;
+    h->count--;
+    return h->entries[ix].val;
+}
+
+void *hashmapq_ordered_put(
+    hashmapq_ordered_t * h,
+    void *k,
+    void *v
+)
+{
+    hashmapq_ordered_entry_t *e;
+    unsigned long hash;
+    int ix;
+
+    if (!k || !v)
+        return NULL;
+
+    hash = h->hash(k);
+
+    ix = __find(h, k, hash, NULL);
+    if (-1 != ix)
+    {
+        void *old = h->entries[ix].val;
+
+        h->entries[ix].val = v;
+        return old;
+    }
+
+    __ensurecapacity(h);
+
+    ix = h->nentries++;
+    e = &h->entries[ix];
+    e->hash = hash;
+    e->key = k;
+    e->val = v;
+    __place(h, hash, ix);
+    h->count++;
+    return NULL;
+}
+
+void hashmapq_ordered_iterator(
+    hashmapq_ordered_t * h __attribute__((__unused__)),
+    hashmapq_iterator_t * iter
+)
+{
+    iter->cur = 0;
+}
+
+/**
+ * @return the next entry still in the map, otherwise NULL */
+static hashmapq_ordered_entry_t *__iterator_next(
+    hashmapq_ordered_t * h,
+    hashmapq_iterator_t * iter
+)
+{
+    for (; iter->cur < h->nentries; iter->cur++)
+    {
+        if (!h->entries[iter->cur].key)
+            continue;
+
+        return &h->entries[iter->cur++];
+    }
+
+    return NULL;
+}
+
+void *hashmapq_ordered_iterator_next(
+    hashmapq_ordered_t * h,
+    hashmapq_iterator_t * iter
+)
+{
+    hashmapq_ordered_entry_t *e = __iterator_next(h, iter);
+
+    return e ? e->key : NULL;
+}
+
+void *hashmapq_ordered_iterator_next_value(
+    hashmapq_ordered_t * h,
+    hashmapq_iterator_t * iter
+)
+{
+    hashmapq_ordered_entry_t *e = __iterator_next(h, iter);
+
+    return e ? e->val : NULL;
+}
@@ -0,0 +1,124 @@
+#ifndef QUADRATIC_PROBING_HASHMAP_ORDERED_H
+#define QUADRATIC_PROBING_HASHMAP_ORDERED_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "quadratic_probing_hashmap.h"
+
+typedef struct
+{
+    unsigned long hash;
+    void *key;
+    void *val;
+} hashmapq_ordered_entry_t;
+
+/**
+ * A hashmap that appends its entries to a dense array, in insertion order.
+ * The quadratic probed table only holds indices into that array, 1, 2 or 4
+ * bytes wide depending on its size. Iterating is a scan over packed
+ * entries, and an empty slot costs a few bytes instead of a whole entry. */
+typedef struct
+{
+    /* number of items within the hashmap */
+    int count;
+    /* entries appended since the last rebuild, inclusive of removed ones */
+    int nentries;
+    /* size of the index table */
+    int size;
+    void *indices;
+    /* removed entries are left in place with a NULL key */
+    hashmapq_ordered_entry_t *entries;
+    func_longhash_f hash;
+    func_longcmp_f compare;
+} hashmapq_ordered_t;
+
+hashmapq_ordered_t *hashmapq_ordered_new(
+    func_longhash_f hash,
+    func_longcmp_f cmp,
+    unsigned int initial_capacity
+);
+
+/**
+ * @return number of items within hash */
+int hashmapq_ordered_count(const hashmapq_ordered_t * hmap);
+
+/**
+ * @return size of the index table used within hash */
+int hashmapq_ordered_size(const hashmapq_ordered_t * hmap);
+
+/**
+ * Empty this hash. */
+void hashmapq_ordered_clear(hashmapq_ordered_t * hmap);
+
+/**
+ * Free all the memory related to this hash.
+ * This includes the actual h itself. */
+void hashmapq_ordered_freeall(hashmapq_ordered_t * hmap);
+
+/**
+ * Get this key's value.
+ * @return key's item, otherwise NULL */
+void *hashmapq_ordered_get(
+    hashmapq_ordered_t * hmap,
+    const void *key
+);
+
+/**
+ * Is this key inside this map?
+ * @return 1 if key is in hash, otherwise 0 */
+int hashmapq_ordered_contains_key(
+    hashmapq_ordered_t * hmap,
+    const void *key
+);
+
+/**
+ * Remove this key and value from the map.
+ * @return value of key, or NULL on failure */
+void *hashmapq_ordered_remove(
+    hashmapq_ordered_t * hmap,
+    const void *key
+);
+
+/**
+ * Associate key with val.
+ * Does not insert key if an equal key exists; its place in the order is
+ * kept.
+ * @return previous associated val; otherwise NULL */
+void *hashmapq_ordered_put(
+    hashmapq_ordered_t * hmap,
+    void *key,
+    void *val
+);
+
+/**
+ * Initialise a new hash iterator over this hash. Items come out in the
+ * order they were first put.
+ * It is safe to remove items while iterating.  */
+void hashmapq_ordered_iterator(
+    hashmapq_ordered_t * hmap,
+    hashmapq_iterator_t * iter
+);
+
+/**
+ * Iterate to the next item on a hash iterator
+ * @return next item key from iterator */
+void *hashmapq_ordered_iterator_next(
+    hashmapq_ordered_t * hmap,
+    hashmapq_iterator_t * iter
+);
+
+/**
+ * Iterate to the next item on a hash iterator
+ * @return next item value from iterator */
+void *hashmapq_ordered_iterator_next_value(
+    hashmapq_ordered_t * hmap,
+    hashmapq_iterator_t * iter
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QUADRATIC_PROBING_HASHMAP_ORDERED_H */
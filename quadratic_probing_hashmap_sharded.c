@@ -0,0 +1,271 @@
+/*
+ 
+Copyright (c) 2011, Willem-Hendrik Thiart
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * The names of its contributors may not be used to endorse or promote
+      products derived from this software without specific prior written
+      permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL WILLEM-HENDRIK THIART BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "quadratic_probing_hashmap_sharded.h"
+
+#define CACHE_LINE 64
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    hashmapq_t *map;
+} __attribute__((aligned(CACHE_LINE))) shard_t;
+
+/**
+ * The shards' own probes use the low bits of the hash, so we pick a shard
+ * with the high bits of a Fibonacci-mixed hash. Weak hashes such as the
+ * identity then still spread over every shard.
+ * @return index of the shard that owns this hash */
+static int __shard_idx(
+    const hashmapq_sharded_t * h,
+    unsigned long hash
+)
+{
+    unsigned long long mixed = hash * 0x9E3779B97F4A7C15ull;
+
+    return (int) (mixed >> 32) & (h->nshards - 1);
+}
+
+static shard_t *__shard(
+    const hashmapq_sharded_t * h,
+    int idx
+)
+{
+    return &((shard_t *) h->shards)[idx];
+}
+
+hashmapq_sharded_t *hashmapq_sharded_new(
+    func_longhash_f hash,
+    func_longcmp_f cmp,
+    unsigned int nshards,
+    unsigned int initial_capacity,
+    int flags
+)
+{
+    hashmapq_sharded_t *h;
+    int ii;
+
+    assert(hash);
+    assert(nshards && !(nshards & (nshards - 1)));
+
+    h = calloc(1, sizeof(hashmapq_sharded_t));
+    h->nshards = nshards;
+    h->hash = hash;
+    if (0 != posix_memalign(&h->shards, CACHE_LINE,
+                            nshards * sizeof(shard_t)))
+    {
+        free(h);
+        return NULL;
+    }
+
+    for (ii = 0; ii < h->nshards; ii++)
+    {
+        pthread_mutex_init(&__shard(h, ii)->lock, NULL);
+        __shard(h, ii)->map = hashmapq_new_with_flags(hash, cmp,
+                                                      initial_capacity, flags);
+    }
+    return h;
+}
+
+int hashmapq_sharded_count(hashmapq_sharded_t * h)
+{
+    int ii, count = 0;
+
+    for (ii = 0; ii < h->nshards; ii++)
+    {
+        shard_t *s = __shard(h, ii);
+
+        pthread_mutex_lock(&s->lock);
+        count += hashmapq_count(s->map);
+        pthread_mutex_unlock(&s->lock);
+    }
+    return count;
+}
+
+static void __clear_shard(
+    hashmapq_t * shard,
+    void *udata
+)
+{
+    (void) udata;
+    hashmapq_clear(shard);
+}
+
+void hashmapq_sharded_clear(hashmapq_sharded_t * h)
+{
+    hashmapq_sharded_for_each_shard(h, __clear_shard, NULL);
+}
+
+void hashmapq_sharded_freeall(hashmapq_sharded_t * h)
+{
+    int ii;
+
+    assert(h);
+    for (ii = 0; ii < h->nshards; ii++)
+    {
+        pthread_mutex_destroy(&__shard(h, ii)->lock);
+        hashmapq_freeall(__shard(h, ii)->map);
+    }
+    free(h->shards);
+    free(h);
+}
+
+void *hashmapq_sharded_get(
+    hashmapq_sharded_t * h,
+    const void *key
+)
+{
+    unsigned long hash;
+    shard_t *s;
+    void *val;
+
+    if (!key)
+        return NULL;
+
+    /* hash outside the lock, the shard then reuses it */
+    hash = h->hash(key);
+    s = __shard(h, __shard_idx(h, hash));
+    pthread_mutex_lock(&s->lock);
+    val = hashmapq_get_with_hash(s->map, key, hash);
+    pthread_mutex_unlock(&s->lock);
+    return val;
+}
+
+int hashmapq_sharded_contains_key(
+    hashmapq_sharded_t * h,
+    const void *key
+)
+{
+    return (NULL != hashmapq_sharded_get(h, key));
+}
+
+void *hashmapq_sharded_remove(
+    hashmapq_sharded_t * h,
+    const void *key
+)
+{
+    unsigned long hash;
+    shard_t *s;
+    void *val;
+
+    if (!key)
+        return NULL;
+
+    hash = h->hash(key);
+    s = __shard(h, __shard_idx(h, hash));
+    pthread_mutex_lock(&s->lock);
+    val = hashmapq_remove_with_hash(s->map, key, hash);
+    pthread_mutex_unlock(&s->lock);
+    return val;
+}
+
+void *hashmapq_sharded_put(
+    hashmapq_sharded_t * h,
+    void *key,
+    void *val
+)
+{
+    unsigned long hash;
+    shard_t *s;
+    void *old;
+
+    if (!key)
+        return NULL;
+
+    hash = h->hash(key);
+    s = __shard(h, __shard_idx(h, hash));
+    pthread_mutex_lock(&s->lock);
+    old = hashmapq_put_with_hash(s->map, key, val, hash);
+    pthread_mutex_unlock(&s->lock);
+    return old;
+}
+
+void hashmapq_sharded_for_each_shard(
+    hashmapq_sharded_t * h,
+    void (*fn)(hashmapq_t * shard, void *udata),
+    void *udata
+)
+{
+    int ii;
+
+    for (ii = 0; ii < h->nshards; ii++)
+    {
+        shard_t *s = __shard(h, ii);
+
+        pthread_mutex_lock(&s->lock);
+        fn(s->map, udata);
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+void hashmapq_sharded_iterator(
+    hashmapq_sharded_t * h,
+    hashmapq_sharded_iterator_t * iter
+)
+{
+    shard_t *s = __shard(h, 0);
+
+    iter->shard = 0;
+    pthread_mutex_lock(&s->lock);
+    hashmapq_iterator(s->map, &iter->iter);
+    pthread_mutex_unlock(&s->lock);
+}
+
+void *hashmapq_sharded_iterator_next(
+    hashmapq_sharded_t * h,
+    hashmapq_sharded_iterator_t * iter
+)
+{
+    while (iter->shard < h->nshards)
+    {
+        shard_t *s = __shard(h, iter->shard);
+        void *key;
+
+        pthread_mutex_lock(&s->lock);
+        key = hashmapq_iterator_next(s->map, &iter->iter);
+        if (!key && ++iter->shard < h->nshards)
+        {
+            shard_t *next = __shard(h, iter->shard);
+
+            pthread_mutex_unlock(&s->lock);
+            pthread_mutex_lock(&next->lock);
+            hashmapq_iterator(next->map, &iter->iter);
+            pthread_mutex_unlock(&next->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&s->lock);
+        return key;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,123 @@
+#ifndef QUADRATIC_PROBING_HASHMAP_SHARDED_H
+#define QUADRATIC_PROBING_HASHMAP_SHARDED_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "quadratic_probing_hashmap.h"
+
+/**
+ * A hashmap for many threads. Keys are spread by the high bits of their
+ * (mixed) hash over independent hashmapq_t shards, each behind its own lock
+ * on its own cache line. Threads working on different shards don't contend,
+ * and a resize only blocks the shard that is growing. */
+typedef struct
+{
+    /* always a power of two */
+    int nshards;
+    void *shards;
+    func_longhash_f hash;
+} hashmapq_sharded_t;
+
+typedef struct
+{
+    int shard;
+    hashmapq_iterator_t iter;
+} hashmapq_sharded_iterator_t;
+
+/**
+ * Create a new sharded hashmap.
+ * @param nshards number of shards, a power of two. A few times the number
+ *  of writing threads is a good start
+ * @param initial_capacity capacity of each shard
+ * @param flags HASHMAPQ_* flags for each shard */
+hashmapq_sharded_t *hashmapq_sharded_new(
+    func_longhash_f hash,
+    func_longcmp_f cmp,
+    unsigned int nshards,
+    unsigned int initial_capacity,
+    int flags
+);
+
+/**
+ * @return number of items within hash */
+int hashmapq_sharded_count(hashmapq_sharded_t * hmap);
+
+/**
+ * Empty this hash. */
+void hashmapq_sharded_clear(hashmapq_sharded_t * hmap);
+
+/**
+ * Free all the memory related to this hash.
+ * This includes the actual h itself. */
+void hashmapq_sharded_freeall(hashmapq_sharded_t * hmap);
+
+/**
+ * Get this key's value.
+ * @return key's item, otherwise NULL */
+void *hashmapq_sharded_get(
+    hashmapq_sharded_t * hmap,
+    const void *key
+);
+
+/**
+ * Is this key inside this map?
+ * @return 1 if key is in hash, otherwise 0 */
+int hashmapq_sharded_contains_key(
+    hashmapq_sharded_t * hmap,
+    const void *key
+);
+
+/**
+ * Remove this key and value from the map.
+ * @return value of key, or NULL on failure */
+void *hashmapq_sharded_remove(
+    hashmapq_sharded_t * hmap,
+    const void *key
+);
+
+/**
+ * Associate key with val.
+ * Does not insert key if an equal key exists.
+ * @return previous associated val; otherwise NULL */
+void *hashmapq_sharded_put(
+    hashmapq_sharded_t * hmap,
+    void *key,
+    void *val
+);
+
+/**
+ * Call fn on each shard in turn while holding that shard's lock.
+ * fn may use the whole hashmapq_* API on the shard, but must only add keys
+ * that belong to it (ie. keys it found there).
+ * @param udata passed through to fn */
+void hashmapq_sharded_for_each_shard(
+    hashmapq_sharded_t * hmap,
+    void (*fn)(hashmapq_t * shard, void *udata),
+    void *udata
+);
+
+/**
+ * Initialise a new hash iterator over this hash
+ * It is safe to remove items while iterating. Items put by other threads
+ * while iterating may or may not be seen, and a put that grows a shard we
+ * are walking can cause keys to be seen twice. */
+void hashmapq_sharded_iterator(
+    hashmapq_sharded_t * hmap,
+    hashmapq_sharded_iterator_t * iter
+);
+
+/**
+ * Iterate to the next item on a hash iterator
+ * @return next item key from iterator */
+void *hashmapq_sharded_iterator_next(
+    hashmapq_sharded_t * hmap,
+    hashmapq_sharded_iterator_t * iter
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QUADRATIC_PROBING_HASHMAP_SHARDED_H */
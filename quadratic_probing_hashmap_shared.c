@@ -0,0 +1,598 @@
+/*
+ 
+Copyright (c) 2011, Willem-Hendrik Thiart
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * The names of its contributors may not be used to endorse or promote
+      products derived from this software without specific prior written
+      permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL WILLEM-HENDRIK THIART BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "quadratic_probing_hashmap.h"
+#include "quadratic_probing_hashmap_shared.h"
+
+#define SHARED_MAGIC 0x4853514d48505148ull
+#define SHARED_VERSION 2
+
+/* when we call for more capacity */
+#define SPACERATIO 0.5
+
+/* slot entries below this aren't offsets */
+#define EMPTY 0
+#define TOMBSTONE 1
+
+typedef struct
+{
+    uint64_t hash;
+    /* offset of the slot's entry_t, or EMPTY or TOMBSTONE */
+    uint64_t entry;
+} slot_t;
+
+typedef struct
+{
+    uint64_t size;
+    slot_t slots[];
+} table_t;
+
+typedef struct
+{
+    uint32_t key_len;
+    uint32_t val_len;
+    /* key bytes then val bytes */
+    char bytes[];
+} entry_t;
+
+/* The file starts with this header page. The rest is split into two
+ * halves, and the table and entries live in one of them. Entries are
+ * appended to the current half until it fills up, then the live ones are
+ * copied into the other half with a fresh table; growing the table does
+ * the same. Either way the epoch is bumped before the other half is written
+ * and again after the new table is published, so a get that saw the epoch
+ * change retries rather than trust what it read. */
+typedef struct
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t initial_size;
+    /* bytes in the file */
+    uint64_t len;
+    /* offset of the first half, and bytes in each half */
+    uint64_t first;
+    uint64_t half_len;
+    pthread_mutex_t lock;
+    uint64_t epoch;
+    /* offset of the current table_t */
+    uint64_t table;
+    /* free space in the current half; only used under the lock */
+    uint64_t heap;
+    uint64_t heap_end;
+    /* this is inclusive of tombstones */
+    int32_t slots_used;
+    int32_t count;
+} region_t;
+
+static void *__at(
+    const hashmapq_shared_t * h,
+    uint64_t off
+)
+{
+    return (char *) h->region + off;
+}
+
+/**
+ * @return 1 if len bytes at off are inside the mapping. Gets racing a
+ *  writer can read nonsense offsets, and must check before following them */
+static int __in_region(
+    const hashmapq_shared_t * h,
+    uint64_t off,
+    uint64_t len
+)
+{
+    return off <= h->len && len <= h->len - off;
+}
+
+/**
+ * Every process needs the same hash for a key, so it can't be a callback */
+static uint64_t __hash(
+    const void *key,
+    size_t len
+)
+{
+    return hashmapq_hash_bytes(key, len, 0);
+}
+
+static uint64_t __probe(
+    uint64_t hash,
+    uint64_t i,
+    uint64_t size
+)
+{
+    return (hash + i / 2 + (i * i) / 2) & (size - 1);
+}
+
+/**
+ * Copy a key and val into the current half's free space.
+ * @return offset of the new entry_t, or 0 if the half is full */
+static uint64_t __new_entry(
+    hashmapq_shared_t * h,
+    const void *key,
+    size_t key_len,
+    const void *val,
+    size_t val_len
+)
+{
+    region_t *r = h->region;
+    uint64_t off = r->heap, len;
+    entry_t *e;
+
+    len = (sizeof(entry_t) + key_len + val_len + 7) & ~7ull;
+    if (r->heap_end - r->heap < len)
+        return 0;
+
+    e = __at(h, off);
+    e->key_len = key_len;
+    e->val_len = val_len;
+    memcpy(e->bytes, key, key_len);
+    memcpy(e->bytes + key_len, val, val_len);
+    r->heap += len;
+    return off;
+}
+
+/**
+ * Find key's slot for a writer.
+ * @param found set to 1 if key is there
+ * @return key's slot, otherwise the slot to put it in */
+static slot_t *__find(
+    hashmapq_shared_t * h,
+    table_t * t,
+    uint64_t hash,
+    const void *key,
+    size_t key_len,
+    int *found
+)
+{
+    slot_t *tomb = NULL;
+    uint64_t i;
+
+    *found = 0;
+    for (i = 0; i < t->size; i++)
+    {
+        slot_t *s = &t->slots[__probe(hash, i, t->size)];
+        entry_t *e;
+
+        if (EMPTY == s->entry)
+            return tomb ? tomb : s;
+
+        if (TOMBSTONE == s->entry)
+        {
+            /* the key might still be further along the chain */
+            if (!tomb)
+                tomb = s;
+            continue;
+        }
+
+        e = __at(h, s->entry);
+        if (s->hash == hash && e->key_len == key_len &&
+            0 == memcmp(e->bytes, key, key_len))
+        {
+            *found = 1;
+            return s;
+        }
+    }
+
+    return tomb;
+}
+
+/**
+ * Move the live entries into the other half, under a new table of size
+ * slots, and make that current. The old half's pages go back to the
+ * kernel.
+ * @param keep 0 to drop the entries instead
+ * @return 0 on success, or -1 if they don't fit */
+static int __collect(
+    hashmapq_shared_t * h,
+    uint64_t size,
+    int keep
+)
+{
+    region_t *r = h->region;
+    table_t *old = __at(h, r->table), *t;
+    uint64_t cur, base, ii, heap = r->heap, heap_end = r->heap_end;
+    int count = 0;
+
+    /* derive the halves from the published table, not from anything a
+     * writer that died mid-collect may have left behind */
+    cur = r->table < r->first + r->half_len ? r->first :
+        r->first + r->half_len;
+    base = cur == r->first ? r->first + r->half_len : r->first;
+
+    if ((r->half_len - sizeof(table_t)) / sizeof(slot_t) < size)
+        return -1;
+
+    __atomic_fetch_add(&r->epoch, 1, __ATOMIC_SEQ_CST);
+
+    t = __at(h, base);
+    t->size = size;
+    memset(t->slots, 0, size * sizeof(slot_t));
+    r->heap = base + sizeof(table_t) + size * sizeof(slot_t);
+    r->heap_end = base + r->half_len;
+
+    for (ii = 0; keep && ii < old->size; ii++)
+    {
+        slot_t *s = &old->slots[ii], *to;
+        entry_t *e;
+        uint64_t i;
+
+        if (s->entry <= TOMBSTONE)
+            continue;
+
+        e = __at(h, s->entry);
+        for (i = 0; (to = &t->slots[__probe(s->hash, i, size)])->entry; i++)
+            ;
+        to->hash = s->hash;
+        to->entry = __new_entry(h, e->bytes, e->key_len,
+                                e->bytes + e->key_len, e->val_len);
+        if (!to->entry)
+        {
+            r->heap = heap;
+            r->heap_end = heap_end;
+            return -1;
+        }
+        count++;
+    }
+
+    r->slots_used = count;
+    __atomic_store_n(&r->count, count, __ATOMIC_RELAXED);
+    __atomic_store_n(&r->table, base, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&r->epoch, 1, __ATOMIC_SEQ_CST);
+
+    madvise(__at(h, cur), r->half_len, MADV_REMOVE);
+    return 0;
+}
+
+static void __lock(
+    hashmapq_shared_t * h
+)
+{
+    region_t *r = h->region;
+
+    if (EOWNERDEAD == pthread_mutex_lock(&r->lock))
+    {
+        /* its owner died mid-update. Nothing it hadn't published is
+         * reachable, but the counts and free space may be off; collecting
+         * works them out again */
+        pthread_mutex_consistent(&r->lock);
+        __collect(h, ((table_t *) __at(h, r->table))->size, 1);
+    }
+}
+
+static void __unlock(
+    hashmapq_shared_t * h
+)
+{
+    pthread_mutex_unlock(&((region_t *) h->region)->lock);
+}
+
+static hashmapq_shared_t *__map(
+    int fd,
+    size_t len
+)
+{
+    hashmapq_shared_t *h;
+    void *p;
+
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == p)
+        return NULL;
+
+    h = calloc(1, sizeof(hashmapq_shared_t));
+    h->region = p;
+    h->len = len;
+    return h;
+}
+
+hashmapq_shared_t *hashmapq_shared_new(
+    int fd,
+    size_t len,
+    unsigned int initial_capacity
+)
+{
+    uint64_t page = sysconf(_SC_PAGESIZE), half_len;
+    pthread_mutexattr_t attr;
+    hashmapq_shared_t *h;
+    region_t *r;
+    table_t *t;
+
+    assert(initial_capacity && !(initial_capacity & (initial_capacity - 1)));
+    assert(sizeof(region_t) <= page);
+
+    half_len = len < page ? 0 : (len - page) / 2 / page * page;
+    if (half_len < sizeof(table_t) + initial_capacity * sizeof(slot_t))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (ftruncate(fd, len) || !(h = __map(fd, len)))
+        return NULL;
+
+    r = h->region;
+    memset(r, 0, sizeof(region_t));
+    r->version = SHARED_VERSION;
+    r->initial_size = initial_capacity;
+    r->len = len;
+    r->first = page;
+    r->half_len = half_len;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&r->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    r->table = r->first;
+    t = __at(h, r->table);
+    t->size = initial_capacity;
+    memset(t->slots, 0, initial_capacity * sizeof(slot_t));
+    r->heap = r->table + sizeof(table_t) + initial_capacity * sizeof(slot_t);
+    r->heap_end = r->first + r->half_len;
+
+    /* attaching processes check this last */
+    __atomic_store_n(&r->magic, SHARED_MAGIC, __ATOMIC_RELEASE);
+    return h;
+}
+
+hashmapq_shared_t *hashmapq_shared_attach(
+    int fd
+)
+{
+    hashmapq_shared_t *h;
+    struct stat st;
+    region_t *r;
+
+    if (-1 == fstat(fd, &st))
+        return NULL;
+
+    if ((size_t) st.st_size < sizeof(region_t) ||
+        !(h = __map(fd, st.st_size)))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    r = h->region;
+    if (SHARED_MAGIC != __atomic_load_n(&r->magic, __ATOMIC_ACQUIRE) ||
+        SHARED_VERSION != r->version || h->len != r->len)
+    {
+        hashmapq_shared_detach(h);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return h;
+}
+
+void hashmapq_shared_detach(
+    hashmapq_shared_t * h
+)
+{
+    assert(h);
+    munmap(h->region, h->len);
+    free(h);
+}
+
+int hashmapq_shared_count(
+    hashmapq_shared_t * h
+)
+{
+    return __atomic_load_n(&((region_t *) h->region)->count,
+                           __ATOMIC_RELAXED);
+}
+
+void hashmapq_shared_clear(
+    hashmapq_shared_t * h
+)
+{
+    __lock(h);
+    __collect(h, ((region_t *) h->region)->initial_size, 0);
+    __unlock(h);
+}
+
+/**
+ * Look the key up without the lock. Whatever is read may be torn by a
+ * concurrent collect, so everything is bounds checked; the caller throws
+ * the result away if the epoch moved.
+ * @return length of key's value, otherwise -1 */
+static ssize_t __lookup(
+    hashmapq_shared_t * h,
+    uint64_t hash,
+    const void *key,
+    size_t key_len,
+    void *val,
+    size_t len
+)
+{
+    region_t *r = h->region;
+    uint64_t toff, size, i;
+    const table_t *t;
+
+    toff = __atomic_load_n(&r->table, __ATOMIC_ACQUIRE);
+    if (!__in_region(h, toff, sizeof(table_t)))
+        return -1;
+
+    t = __at(h, toff);
+    size = t->size;
+    if (!size || (size & (size - 1)) || h->len / sizeof(slot_t) < size ||
+        !__in_region(h, toff + sizeof(table_t), size * sizeof(slot_t)))
+        return -1;
+
+    for (i = 0; i < size; i++)
+    {
+        const slot_t *s = &t->slots[__probe(hash, i, size)];
+        uint64_t off = __atomic_load_n(&s->entry, __ATOMIC_ACQUIRE);
+        const entry_t *e;
+        uint32_t elen, vlen;
+
+        if (EMPTY == off)
+            return -1;
+
+        if (TOMBSTONE == off ||
+            hash != __atomic_load_n(&s->hash, __ATOMIC_RELAXED) ||
+            !__in_region(h, off, sizeof(entry_t)))
+            continue;
+
+        e = __at(h, off);
+        elen = e->key_len;
+        vlen = e->val_len;
+        if (elen != key_len ||
+            !__in_region(h, off + sizeof(entry_t), (uint64_t) elen + vlen) ||
+            0 != memcmp(e->bytes, key, key_len))
+            continue;
+
+        if (len)
+            memcpy(val, e->bytes + key_len, vlen < len ? vlen : len);
+        return vlen;
+    }
+
+    return -1;
+}
+
+ssize_t hashmapq_shared_get(
+    hashmapq_shared_t * h,
+    const void *key,
+    size_t key_len,
+    void *val,
+    size_t len
+)
+{
+    region_t *r = h->region;
+    uint64_t hash = __hash(key, key_len);
+
+    for (;;)
+    {
+        uint64_t epoch = __atomic_load_n(&r->epoch, __ATOMIC_ACQUIRE);
+        ssize_t got = __lookup(h, hash, key, key_len, val, len);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (epoch == __atomic_load_n(&r->epoch, __ATOMIC_RELAXED))
+            return got;
+    }
+}
+
+int hashmapq_shared_contains_key(
+    hashmapq_shared_t * h,
+    const void *key,
+    size_t key_len
+)
+{
+    return -1 != hashmapq_shared_get(h, key, key_len, NULL, 0);
+}
+
+int hashmapq_shared_remove(
+    hashmapq_shared_t * h,
+    const void *key,
+    size_t key_len
+)
+{
+    region_t *r = h->region;
+    slot_t *s;
+    int found;
+
+    __lock(h);
+    s = __find(h, __at(h, r->table), __hash(key, key_len), key, key_len,
+               &found);
+    if (found)
+    {
+        __atomic_store_n(&s->entry, TOMBSTONE, __ATOMIC_RELEASE);
+        __atomic_store_n(&r->count, r->count - 1, __ATOMIC_RELAXED);
+    }
+    __unlock(h);
+    return found;
+}
+
+int hashmapq_shared_put(
+    hashmapq_shared_t * h,
+    const void *key,
+    size_t key_len,
+    const void *val,
+    size_t val_len
+)
+{
+    region_t *r = h->region;
+    uint64_t hash = __hash(key, key_len);
+    int tries, ret = -1;
+
+    __lock(h);
+    for (tries = 0; tries < 2; tries++)
+    {
+        table_t *t = __at(h, r->table);
+        uint64_t off;
+        slot_t *s;
+        int found;
+
+        if (t->size * SPACERATIO <= r->slots_used)
+        {
+            /* tombstones filled us up; there's no need to grow */
+            uint64_t size = r->count < t->size * SPACERATIO / 2 ?
+                t->size : t->size * 2;
+
+            if (-1 == __collect(h, size, 1))
+                break;
+            t = __at(h, r->table);
+        }
+
+        s = __find(h, t, hash, key, key_len, &found);
+        if (!(off = __new_entry(h, key, key_len, val, val_len)))
+        {
+            /* collecting frees the space of removed and replaced entries */
+            if (0 == tries && 0 == __collect(h, t->size, 1))
+                continue;
+            break;
+        }
+
+        if (!found)
+        {
+            if (EMPTY == s->entry)
+                r->slots_used++;
+            __atomic_store_n(&r->count, r->count + 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&s->hash, hash, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&s->entry, off, __ATOMIC_RELEASE);
+        ret = found;
+        break;
+    }
+    __unlock(h);
+
+    if (-1 == ret)
+        errno = ENOSPC;
+    return ret;
+}
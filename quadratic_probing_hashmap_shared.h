@@ -0,0 +1,110 @@
+#ifndef QUADRATIC_PROBING_HASHMAP_SHARED_H
+#define QUADRATIC_PROBING_HASHMAP_SHARED_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * A hashmap that lives entirely inside a shared memory file (eg. from
+ * memfd_create() or shm_open()), so that many processes can use one copy.
+ * Everything in the file refers to everything else by offset, and keys and
+ * vals are byte strings copied into it.
+ *
+ * Gets take no lock: they retry if a writer moved the table under them.
+ * Puts and removes take a process-shared lock. A process that dies holding
+ * it doesn't leave the map inconsistent. */
+typedef struct
+{
+    /* this process's mapping of the file */
+    void *region;
+    size_t len;
+} hashmapq_shared_t;
+
+/**
+ * Lay out a new map in fd, growing the file to len bytes. The map's pages
+ * are only backed by memory once used, so len can be generous. The table
+ * grows within the file, but the file itself never grows.
+ * @param initial_capacity a power of two
+ * @return the map, or NULL with errno set */
+hashmapq_shared_t *hashmapq_shared_new(
+    int fd,
+    size_t len,
+    unsigned int initial_capacity
+);
+
+/**
+ * Use the map another process laid out in fd with hashmapq_shared_new().
+ * @return the map, or NULL with errno set if fd doesn't hold one */
+hashmapq_shared_t *hashmapq_shared_attach(
+    int fd
+);
+
+/**
+ * Unmap the map from this process. The map itself lives on in the file. */
+void hashmapq_shared_detach(
+    hashmapq_shared_t * hmap
+);
+
+/**
+ * @return number of items within hash */
+int hashmapq_shared_count(
+    hashmapq_shared_t * hmap
+);
+
+/**
+ * Empty this hash. */
+void hashmapq_shared_clear(
+    hashmapq_shared_t * hmap
+);
+
+/**
+ * Copy this key's value into val.
+ * @param len room at val. Values longer than that are cut short
+ * @return length of the whole value, otherwise -1 if the key isn't there */
+ssize_t hashmapq_shared_get(
+    hashmapq_shared_t * hmap,
+    const void *key,
+    size_t key_len,
+    void *val,
+    size_t len
+);
+
+/**
+ * Is this key inside this map?
+ * @return 1 if key is in hash, otherwise 0 */
+int hashmapq_shared_contains_key(
+    hashmapq_shared_t * hmap,
+    const void *key,
+    size_t key_len
+);
+
+/**
+ * Remove this key and value from the map.
+ * @return 1 if the key was removed, otherwise 0 */
+int hashmapq_shared_remove(
+    hashmapq_shared_t * hmap,
+    const void *key,
+    size_t key_len
+);
+
+/**
+ * Associate key with a copy of val, replacing any value it had.
+ * @return 1 if a value was replaced, 0 if the key was inserted, otherwise
+ *  -1 with errno set to ENOSPC if the file is too full */
+int hashmapq_shared_put(
+    hashmapq_shared_t * hmap,
+    const void *key,
+    size_t key_len,
+    const void *val,
+    size_t val_len
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QUADRATIC_PROBING_HASHMAP_SHARED_H */
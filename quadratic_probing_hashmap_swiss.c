@@ -0,0 +1,376 @@
+/*
+ 
+Copyright (c) 2011, Willem-Hendrik Thiart
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * The names of its contributors may not be used to endorse or promote
+      products derived from this software without specific prior written
+      permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL WILLEM-HENDRIK THIART BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "quadratic_probing_hashmap_swiss.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define GROUP_WIDTH 32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define GROUP_WIDTH 16
+#else
+#define GROUP_WIDTH 16
+#endif
+
+/* when we call for more capacity */
+#define SPACERATIO 0.875
+
+/* control byte values; full slots hold 7 bits of hash, ie. 0 to 127 */
+#define CTRL_EMPTY ((signed char) -128)
+#define CTRL_DELETED ((signed char) -2)
+
+/* the hash bits that select the group, and the bits kept in the tag */
+#define H1(hash) ((hash) >> 7)
+#define H2(hash) ((signed char) ((hash) & 0x7f))
+
+/**
+ * @return bitmask of the slots in the group whose tag equals c */
+static unsigned int __match(
+    const signed char *group,
+    signed char c
+)
+{
+#if defined(__AVX2__)
+    __m256i ctrl = _mm256_loadu_si256((const __m256i *) group);
+    return (unsigned int) _mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(ctrl, _mm256_set1_epi8(c)));
+#elif defined(__SSE2__)
+    __m128i ctrl = _mm_loadu_si128((const __m128i *) group);
+    return (unsigned int) _mm_movemask_epi8(
+        _mm_cmpeq_epi8(ctrl, _mm_set1_epi8(c)));
+#else
+    unsigned int mask = 0;
+    int i;
+
+    for (i = 0; i < GROUP_WIDTH; i++)
+        if (group[i] == c)
+            mask |= 1u << i;
+    return mask;
+#endif
+}
+
+/**
+ * Empty and deleted are the only negative tags.
+ * @return bitmask of the slots in the group that are empty or deleted */
+static unsigned int __match_free(
+    const signed char *group
+)
+{
+#if defined(__AVX2__)
+    return (unsigned int) _mm256_movemask_epi8(
+        _mm256_loadu_si256((const __m256i *) group));
+#elif defined(__SSE2__)
+    return (unsigned int) _mm_movemask_epi8(
+        _mm_loadu_si128((const __m128i *) group));
+#else
+    unsigned int mask = 0;
+    int i;
+
+    for (i = 0; i < GROUP_WIDTH; i++)
+        if (group[i] < 0)
+            mask |= 1u << i;
+    return mask;
+#endif
+}
+
+static int __ngroups(const hashmapq_swiss_t * h)
+{
+    return h->size / GROUP_WIDTH;
+}
+
+static void __alloc_arrays(
+    hashmapq_swiss_t * h,
+    int size
+)
+{
+    h->size = size;
+    h->ctrl = malloc(size);
+    memset(h->ctrl, CTRL_EMPTY, size);
+    h->slots = calloc(size, sizeof(hash_entry_t));
+}
+
+hashmapq_swiss_t *hashmapq_swiss_new(
+    func_longhash_f hash,
+    func_longcmp_f cmp,
+    unsigned int initial_capacity
+)
+{
+    hashmapq_swiss_t *h;
+
+    assert(initial_capacity && !(initial_capacity & (initial_capacity - 1)));
+
+    h = calloc(1, sizeof(hashmapq_swiss_t));
+    __alloc_arrays(h, initial_capacity < GROUP_WIDTH ?
+                   GROUP_WIDTH : initial_capacity);
+    h->hash = hash;
+    h->compare = cmp;
+    return h;
+}
+
+int hashmapq_swiss_count(const hashmapq_swiss_t * h)
+{
+    return h->count;
+}
+
+int hashmapq_swiss_size(const hashmapq_swiss_t * h)
+{
+    return h->size;
+}
+
+void hashmapq_swiss_clear(hashmapq_swiss_t * h)
+{
+    memset(h->ctrl, CTRL_EMPTY, h->size);
+    h->count = 0;
+    h->deleted = 0;
+}
+
+void hashmapq_swiss_freeall(hashmapq_swiss_t * h)
+{
+    assert(h);
+    free(h->ctrl);
+    free(h->slots);
+    free(h);
+}
+
+/**
+ * Walk the group sequence looking for key.
+ * @return array index of key, otherwise -1 */
+static int __find(
+    hashmapq_swiss_t * h,
+    const void *key,
+    unsigned long hash
+)
+{
+    unsigned int g, i, gmask = __ngroups(h) - 1;
+
+    g = H1(hash) & gmask;
+
+    /* triangular steps visit every group when the group count is a
+     * power of two */
+    for (i = 1; i <= gmask + 1; i++)
+    {
+        const signed char *group = h->ctrl + g * GROUP_WIDTH;
+        unsigned int m;
+
+        for (m = __match(group, H2(hash)); m; m &= m - 1)
+        {
+            int idx = g * GROUP_WIDTH + __builtin_ctz(m);
+
+            if (0 == h->compare(key, h->slots[idx].key))
+                return idx;
+        }
+
+        if (__match(group, CTRL_EMPTY))
+            return -1;
+
+        g = (g + i) & gmask;
+    }
+
+    return -1;
+}
+
+/**
+ * @return array index of the first empty or deleted slot for this hash */
+static int __find_free(
+    hashmapq_swiss_t * h,
+    unsigned long hash
+)
+{
+    unsigned int g, i, gmask = __ngroups(h) - 1;
+
+    g = H1(hash) & gmask;
+
+    /* the load factor guarantees we will be able to escape this loop */
+    for (i = 1;; i++)
+    {
+        unsigned int m = __match_free(h->ctrl + g * GROUP_WIDTH);
+
+        if (m)
+            return g * GROUP_WIDTH + __builtin_ctz(m);
+
+        g = (g + i) & gmask;
+    }
+}
+
+static void __rehash(
+    hashmapq_swiss_t * h,
+    int new_size
+)
+{
+    signed char *ctrl_old = h->ctrl;
+    hash_entry_t *slots_old = h->slots;
+    int ii, size_old = h->size;
+
+    __alloc_arrays(h, new_size);
+    h->deleted = 0;
+
+    for (ii = 0; ii < size_old; ii++)
+    {
+        unsigned long hash;
+        int idx;
+
+        if (ctrl_old[ii] < 0)
+            continue;
+
+        hash = h->hash(slots_old[ii].key);
+        idx = __find_free(h, hash);
+        h->ctrl[idx] = H2(hash);
+        h->slots[idx] = slots_old[ii];
+    }
+
+    free(ctrl_old);
+    free(slots_old);
+}
+
+static void __ensurecapacity(hashmapq_swiss_t * h)
+{
+    if ((float) (h->count + h->deleted + 1) / h->size < SPACERATIO)
+        return;
+
+    /* if tombstones are what filled us up, rehashing in place is enough */
+    if (h->count * 2 < h->size * SPACERATIO)
+        __rehash(h, h->size);
+    else
+        __rehash(h, h->size << 1);
+}
+
+void *hashmapq_swiss_get(
+    hashmapq_swiss_t * h,
+    const void *key
+)
+{
+    int idx;
+
+    if (0 == h->count || !key)
+        return NULL;
+
+    idx = __find(h, key, h->hash(key));
+    return -1 == idx ? NULL : h->slots[idx].val;
+}
+
+int hashmapq_swiss_contains_key(
+    hashmapq_swiss_t * h,
+    const void *key
+)
+{
+    return NULL != hashmapq_swiss_get(h, key);
+}
+
+void *hashmapq_swiss_remove(
+    hashmapq_swiss_t * h,
+    const void *key
+)
+{
+    unsigned int group;
+    int idx;
+
+    if (0 == h->count || !key)
+        return NULL;
+
+    idx = __find(h, key, h->hash(key));
+    if (-1 == idx)
+        return NULL;
+
+    /* lookups stop at any group holding an empty slot, so if this group
+     * already has one we don't need a tombstone */
+    group = idx / GROUP_WIDTH * GROUP_WIDTH;
+    if (__match(h->ctrl + group, CTRL_EMPTY))
+        h->ctrl[idx] = CTRL_EMPTY;
+    else
+    {
+        h->ctrl[idx] = CTRL_DELETED;
+        h->deleted++;
+    }
+    h->count--;
+    return h->slots[idx].val;
+}
+
+void *hashmapq_swiss_put(
+    hashmapq_swiss_t * h,
+    void *k,
+    void *v
+)
+{
+    unsigned long hash;
+    int idx;
+
+    if (!k || !v)
+        return NULL;
+
+    hash = h->hash(k);
+
+    idx = __find(h, k, hash);
+    if (-1 != idx)
+    {
+        void *old = h->slots[idx].val;
+
+        h->slots[idx].val = v;
+        return old;
+    }
+
+    __ensurecapacity(h);
+
+    idx = __find_free(h, hash);
+    if (h->ctrl[idx] == CTRL_DELETED)
+        h->deleted--;
+    h->ctrl[idx] = H2(hash);
+    h->slots[idx].key = k;
+    h->slots[idx].val = v;
+    h->count++;
+    return NULL;
+}
+
+void hashmapq_swiss_iterator(
+    hashmapq_swiss_t * h __attribute__((__unused__)),
+    hashmapq_iterator_t * iter
+)
+{
+    iter->cur = 0;
+}
+
+void *hashmapq_swiss_iterator_next(
+    hashmapq_swiss_t * h,
+    hashmapq_iterator_t * iter
+)
+{
+    for (; iter->cur < h->size; iter->cur++)
+    {
+        if (h->ctrl[iter->cur] < 0)
+            continue;
+
+        return h->slots[iter->cur++].key;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,107 @@
+#ifndef QUADRATIC_PROBING_HASHMAP_SWISS_H
+#define QUADRATIC_PROBING_HASHMAP_SWISS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "quadratic_probing_hashmap.h"
+
+/**
+ * A hashmap that keeps a dense array of one byte control tags next to its
+ * key/value slots. Each tag is empty, deleted, or 7 bits of the key's hash.
+ * Lookups scan a whole group of tags at once (with SSE2/AVX2 when
+ * available) and only touch a slot when its tag matches. The quadratic probe
+ * sequence advances group by group instead of slot by slot. */
+typedef struct
+{
+    /* number of items within the hashmap */
+    int count;
+    /* tombstones, these take up capacity until the next rehash */
+    int deleted;
+    /* size of the array, always a multiple of the group width */
+    int size;
+    signed char *ctrl;
+    hash_entry_t *slots;
+    func_longhash_f hash;
+    func_longcmp_f compare;
+} hashmapq_swiss_t;
+
+hashmapq_swiss_t *hashmapq_swiss_new(
+    func_longhash_f hash,
+    func_longcmp_f cmp,
+    unsigned int initial_capacity
+);
+
+/**
+ * @return number of items within hash */
+int hashmapq_swiss_count(const hashmapq_swiss_t * hmap);
+
+/**
+ * @return size of the array used within hash */
+int hashmapq_swiss_size(const hashmapq_swiss_t * hmap);
+
+/**
+ * Empty this hash. */
+void hashmapq_swiss_clear(hashmapq_swiss_t * hmap);
+
+/**
+ * Free all the memory related to this hash.
+ * This includes the actual h itself. */
+void hashmapq_swiss_freeall(hashmapq_swiss_t * hmap);
+
+/**
+ * Get this key's value.
+ * @return key's item, otherwise NULL */
+void *hashmapq_swiss_get(
+    hashmapq_swiss_t * hmap,
+    const void *key
+);
+
+/**
+ * Is this key inside this map?
+ * @return 1 if key is in hash, otherwise 0 */
+int hashmapq_swiss_contains_key(
+    hashmapq_swiss_t * hmap,
+    const void *key
+);
+
+/**
+ * Remove this key and value from the map.
+ * @return value of key, or NULL on failure */
+void *hashmapq_swiss_remove(
+    hashmapq_swiss_t * hmap,
+    const void *key
+);
+
+/**
+ * Associate key with val.
+ * Does not insert key if an equal key exists.
+ * @return previous associated val; otherwise NULL */
+void *hashmapq_swiss_put(
+    hashmapq_swiss_t * hmap,
+    void *key,
+    void *val
+);
+
+/**
+ * Initialise a new hash iterator over this hash
+ * It is safe to remove items while iterating.  */
+void hashmapq_swiss_iterator(
+    hashmapq_swiss_t * hmap,
+    hashmapq_iterator_t * iter
+);
+
+/**
+ * Iterate to the next item on a hash iterator
+ * @return next item key from iterator */
+void *hashmapq_swiss_iterator_next(
+    hashmapq_swiss_t * hmap,
+    hashmapq_iterator_t * iter
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QUADRATIC_PROBING_HASHMAP_SWISS_H */
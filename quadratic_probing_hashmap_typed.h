@@ -0,0 +1,322 @@
+#ifndef QUADRATIC_PROBING_HASHMAP_TYPED_H
+#define QUADRATIC_PROBING_HASHMAP_TYPED_H
+
+/**
+ * Type-specialized quadratic probing hashmaps.
+ *
+ * QPH_DECLARE(name, key_t, val_t, hash_fn, eq_fn) generates
+ * hashmapq_<name>_t and a static inline hashmapq_<name>_* API that stores
+ * keys and values directly in the slots. Slot state lives in a separate byte
+ * array, so every key and value (including 0 and NULL) can be stored.
+ *
+ * hash_fn(key) returns an unsigned long, and eq_fn(a, b) is non-zero when
+ * a and b are equal. Both may be macros.
+ *
+ * eg.
+ *  QPH_DECLARE(u64, uint64_t, uint64_t, QPH_INT_HASH, QPH_INT_EQ)
+ *
+ *  hashmapq_u64_t *h = hashmapq_u64_new(16);
+ *  hashmapq_u64_put(h, 0, 42, NULL);
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "quadratic_probing_hashmap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* slot states */
+#define QPH_EMPTY 0
+#define QPH_FULL 1
+#define QPH_TOMBSTONE 2
+
+/* when we call for more capacity; same as quadratic_probing_hashmap.c */
+#define QPH_SPACERATIO 0.5
+
+#define QPH_INT_HASH(key) ((unsigned long) (key))
+#define QPH_INT_EQ(a, b) ((a) == (b))
+
+#define QPH_DECLARE(name, key_t, val_t, hash_fn, eq_fn)                      \
+                                                                              \
+typedef struct                                                                \
+{                                                                             \
+    /* this is inclusive of tombstones */                                     \
+    int slots_used;                                                           \
+    /* number of items within the hashmap */                                  \
+    int count;                                                                \
+    /* size of the arrays */                                                  \
+    int size;                                                                 \
+    unsigned char *state;                                                     \
+    key_t *keys;                                                              \
+    val_t *vals;                                                              \
+} hashmapq_##name##_t;                                                        \
+                                                                              \
+static inline unsigned int hashmapq_##name##__probe(                          \
+    const hashmapq_##name##_t * h,                                            \
+    unsigned long hash,                                                       \
+    unsigned int i)                                                           \
+{                                                                             \
+    return (hash + (i/2) + (i * i)/2) & (h->size - 1);                        \
+}                                                                             \
+                                                                              \
+static inline void hashmapq_##name##__alloc(                                  \
+    hashmapq_##name##_t * h,                                                  \
+    int size)                                                                 \
+{                                                                             \
+    h->size = size;                                                           \
+    h->state = (unsigned char *) calloc(size, 1);                             \
+    h->keys = (key_t *) malloc(size * sizeof(key_t));                         \
+    h->vals = (val_t *) malloc(size * sizeof(val_t));                         \
+}                                                                             \
+                                                                              \
+static inline hashmapq_##name##_t *hashmapq_##name##_new(                     \
+    unsigned int initial_capacity)                                            \
+{                                                                             \
+    hashmapq_##name##_t *h;                                                   \
+                                                                              \
+    assert(initial_capacity &&                                                \
+           !(initial_capacity & (initial_capacity - 1)));                     \
+                                                                              \
+    h = (hashmapq_##name##_t *) calloc(1, sizeof(hashmapq_##name##_t));       \
+    hashmapq_##name##__alloc(h, initial_capacity);                            \
+    return h;                                                                 \
+}                                                                             \
+                                                                              \
+static inline int hashmapq_##name##_count(const hashmapq_##name##_t * h)      \
+{                                                                             \
+    return h->count;                                                          \
+}                                                                             \
+                                                                              \
+static inline int hashmapq_##name##_size(const hashmapq_##name##_t * h)       \
+{                                                                             \
+    return h->size;                                                           \
+}                                                                             \
+                                                                              \
+static inline void hashmapq_##name##_clear(hashmapq_##name##_t * h)           \
+{                                                                             \
+    memset(h->state, QPH_EMPTY, h->size);                                     \
+    h->count = 0;                                                             \
+    h->slots_used = 0;                                                        \
+}                                                                             \
+                                                                              \
+static inline void hashmapq_##name##_freeall(hashmapq_##name##_t * h)         \
+{                                                                             \
+    assert(h);                                                                \
+    free(h->state);                                                           \
+    free(h->keys);                                                            \
+    free(h->vals);                                                            \
+    free(h);                                                                  \
+}                                                                             \
+                                                                              \
+/* @return array index of key, otherwise -1 */                                \
+static inline int hashmapq_##name##__find(                                    \
+    const hashmapq_##name##_t * h,                                            \
+    key_t key)                                                                \
+{                                                                             \
+    unsigned long hash;                                                       \
+    unsigned int i;                                                           \
+                                                                              \
+    if (0 == h->count)                                                        \
+        return -1;                                                            \
+                                                                              \
+    hash = hash_fn(key);                                                      \
+                                                                              \
+    for (i=0;;i++)                                                            \
+    {                                                                         \
+        unsigned int idx = hashmapq_##name##__probe(h, hash, i);              \
+                                                                              \
+        if (h->state[idx] == QPH_EMPTY) return -1;                            \
+        if (h->state[idx] == QPH_TOMBSTONE) continue;                         \
+        if (eq_fn(h->keys[idx], key)) return idx;                             \
+    }                                                                         \
+}                                                                             \
+                                                                              \
+/* Get this key's value.                                                      \
+ * @return pointer to key's value, valid until the next put; otherwise NULL */\
+static inline val_t *hashmapq_##name##_get(                                   \
+    hashmapq_##name##_t * h,                                                  \
+    key_t key)                                                                \
+{                                                                             \
+    int idx = hashmapq_##name##__find(h, key);                                \
+    return -1 == idx ? NULL : &h->vals[idx];                                  \
+}                                                                             \
+                                                                              \
+static inline int hashmapq_##name##_contains_key(                             \
+    const hashmapq_##name##_t * h,                                            \
+    key_t key)                                                                \
+{                                                                             \
+    return -1 != hashmapq_##name##__find(h, key);                             \
+}                                                                             \
+                                                                              \
+/* Remove this key and value from the map.                                    \
+ * @param val if not NULL, receives the removed value                         \
+ * @return 1 if the key was removed, otherwise 0 */                           \
+static inline int hashmapq_##name##_remove(                                   \
+    hashmapq_##name##_t * h,                                                  \
+    key_t key,                                                                \
+    val_t *val)                                                               \
+{                                                                             \
+    int idx = hashmapq_##name##__find(h, key);                                \
+                                                                              \
+    if (-1 == idx)                                                            \
+        return 0;                                                             \
+                                                                              \
+    if (val)                                                                  \
+        *val = h->vals[idx];                                                  \
+    h->state[idx] = QPH_TOMBSTONE;                                            \
+    h->count--;                                                               \
+    return 1;                                                                 \
+}                                                                             \
+                                                                              \
+/* Insert without checking capacity or looking for an equal key */            \
+static inline void hashmapq_##name##__insert_new(                             \
+    hashmapq_##name##_t * h,                                                  \
+    key_t key,                                                                \
+    val_t val)                                                                \
+{                                                                             \
+    unsigned long hash = hash_fn(key);                                        \
+    unsigned int i;                                                           \
+                                                                              \
+    for (i=0;;i++)                                                            \
+    {                                                                         \
+        unsigned int idx = hashmapq_##name##__probe(h, hash, i);              \
+                                                                              \
+        if (h->state[idx] != QPH_EMPTY) continue;                             \
+                                                                              \
+        h->state[idx] = QPH_FULL;                                             \
+        h->keys[idx] = key;                                                   \
+        h->vals[idx] = val;                                                   \
+        h->slots_used++;                                                      \
+        h->count++;                                                           \
+        return;                                                               \
+    }                                                                         \
+}                                                                             \
+                                                                              \
+static inline void hashmapq_##name##__rehash(                                 \
+    hashmapq_##name##_t * h,                                                  \
+    int new_size)                                                             \
+{                                                                             \
+    unsigned char *state_old = h->state;                                      \
+    key_t *keys_old = h->keys;                                                \
+    val_t *vals_old = h->vals;                                                \
+    int ii, size_old = h->size;                                               \
+                                                                              \
+    hashmapq_##name##__alloc(h, new_size);                                    \
+    h->count = 0;                                                             \
+    h->slots_used = 0;                                                        \
+                                                                              \
+    for (ii = 0; ii < size_old; ii++)                                         \
+        if (state_old[ii] == QPH_FULL)                                        \
+            hashmapq_##name##__insert_new(h, keys_old[ii], vals_old[ii]);     \
+                                                                              \
+    free(state_old);                                                          \
+    free(keys_old);                                                           \
+    free(vals_old);                                                           \
+}                                                                             \
+                                                                              \
+static inline void hashmapq_##name##_increase_capacity(                       \
+    hashmapq_##name##_t * h)                                                  \
+{                                                                             \
+    hashmapq_##name##__rehash(h, h->size << 1);                               \
+}                                                                             \
+                                                                              \
+/* Associate key with val.                                                    \
+ * @param old if not NULL, receives the value that was replaced              \
+ * @return 1 if an existing value was replaced, 0 if key was inserted */      \
+static inline int hashmapq_##name##_put(                                      \
+    hashmapq_##name##_t * h,                                                  \
+    key_t key,                                                                \
+    val_t val,                                                                \
+    val_t *old)                                                               \
+{                                                                             \
+    unsigned long hash;                                                       \
+    unsigned int i;                                                           \
+    int tomb = -1;                                                            \
+                                                                              \
+    if ((float) h->slots_used / h->size >= QPH_SPACERATIO)                    \
+    {                                                                         \
+        /* tombstones filled us up; there's no need to grow */                \
+        if ((float) h->count / h->size < QPH_SPACERATIO / 2)                  \
+            hashmapq_##name##__rehash(h, h->size);                            \
+        else                                                                  \
+            hashmapq_##name##_increase_capacity(h);                           \
+    }                                                                         \
+                                                                              \
+    hash = hash_fn(key);                                                      \
+                                                                              \
+    for (i=0;;i++)                                                            \
+    {                                                                         \
+        unsigned int idx = hashmapq_##name##__probe(h, hash, i);              \
+                                                                              \
+        if (h->state[idx] == QPH_TOMBSTONE)                                   \
+        {                                                                     \
+            /* the key might still be further along the chain */              \
+            if (-1 == tomb)                                                   \
+                tomb = idx;                                                   \
+        }                                                                     \
+        else if (h->state[idx] == QPH_EMPTY)                                  \
+        {                                                                     \
+            /* reuse the first tombstone we passed */                         \
+            if (-1 != tomb)                                                   \
+                idx = tomb;                                                   \
+            else                                                              \
+                h->slots_used++;                                              \
+                                                                              \
+            h->state[idx] = QPH_FULL;                                         \
+            h->keys[idx] = key;                                               \
+            h->vals[idx] = val;                                               \
+            h->count++;                                                       \
+            return 0;                                                         \
+        }                                                                     \
+        else if (eq_fn(h->keys[idx], key))                                    \
+        {                                                                     \
+            if (old)                                                          \
+                *old = h->vals[idx];                                          \
+            h->vals[idx] = val;                                               \
+            return 1;                                                         \
+        }                                                                     \
+    }                                                                         \
+}                                                                             \
+                                                                              \
+static inline void hashmapq_##name##_iterator(                                \
+    hashmapq_##name##_t * h,                                                  \
+    hashmapq_iterator_t * iter)                                               \
+{                                                                             \
+    (void) h;                                                                 \
+    iter->cur = 0;                                                            \
+}                                                                             \
+                                                                              \
+/* Iterate to the next item. It is safe to remove items while iterating.      \
+ * @param key,val if not NULL, receive the item                              \
+ * @return 1 if there was an item, otherwise 0 */                             \
+static inline int hashmapq_##name##_iterator_next(                            \
+    hashmapq_##name##_t * h,                                                  \
+    hashmapq_iterator_t * iter,                                               \
+    key_t *key,                                                               \
+    val_t *val)                                                               \
+{                                                                             \
+    for (; iter->cur < h->size; iter->cur++)                                  \
+    {                                                                         \
+        if (h->state[iter->cur] != QPH_FULL)                                  \
+            continue;                                                         \
+                                                                              \
+        if (key)                                                              \
+            *key = h->keys[iter->cur];                                        \
+        if (val)                                                              \
+            *val = h->vals[iter->cur];                                        \
+        iter->cur++;                                                          \
+        return 1;                                                             \
+    }                                                                         \
+                                                                              \
+    return 0;                                                                 \
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QUADRATIC_PROBING_HASHMAP_TYPED_H */
@@ -4,6 +4,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "CuTest.h"
 
 #include "quadratic_probing_hashmap.h"
@@ -29,6 +31,26 @@ static long __uint_compare(
     return i1 - i2;
 }
 
+static int __hash_calls = 0;
+static int __compare_calls = 0;
+
+static unsigned long __counting_hash(
+    const void *e1
+)
+{
+    __hash_calls++;
+    return __uint_hash(e1);
+}
+
+static long __counting_compare(
+    const void *e1,
+    const void *e2
+)
+{
+    __compare_calls++;
+    return __uint_compare(e1, e2);
+}
+
 void TesthashmapqQuadratic_New(
     CuTest * tc
 )
@@ -475,3 +497,1639 @@ void TesthashmapqQuadratic_IterateAndRemoveDoesntBreakIteration(
     hashmapq_freeall(hm2);
 }
 
+
+void TesthashmapqQuadratic_StoreHashIncreaseCapacityDoesNotCallHash(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+
+    hm = hashmapq_new_with_flags(__counting_hash, __counting_compare, 4,
+                                 HASHMAPQ_STORE_HASH);
+    hashmapq_put(hm, (void *) 1, (void *) 90);
+    hashmapq_put(hm, (void *) 5, (void *) 91);
+    hashmapq_put(hm, (void *) 2, (void *) 92);
+
+    __hash_calls = 0;
+    hashmapq_increase_capacity(hm);
+    CuAssertTrue(tc, 0 == __hash_calls);
+    CuAssertTrue(tc, 3 == hashmapq_count(hm));
+    CuAssertTrue(tc, 90 == (unsigned long) hashmapq_get(hm, (void *) 1));
+    CuAssertTrue(tc, 91 == (unsigned long) hashmapq_get(hm, (void *) 5));
+    CuAssertTrue(tc, 92 == (unsigned long) hashmapq_get(hm, (void *) 2));
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqQuadratic_StoreHashOnlyComparesOnHashMatch(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+
+    hm = hashmapq_new_with_flags(__counting_hash, __counting_compare, 8,
+                                 HASHMAPQ_STORE_HASH);
+    /*  the following 3 collide: */
+    hashmapq_put(hm, (void *) 1, (void *) 92);
+    hashmapq_put(hm, (void *) 9, (void *) 91);
+    hashmapq_put(hm, (void *) 17, (void *) 90);
+
+    __compare_calls = 0;
+    CuAssertTrue(tc, 90 == (unsigned long) hashmapq_get(hm, (void *) 17));
+    CuAssertTrue(tc, 1 == __compare_calls);
+    CuAssertTrue(tc, 0 == hashmapq_get(hm, (void *) 25));
+    CuAssertTrue(tc, 1 == __compare_calls);
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqQuadratic_IncrementalResizeKeepsOldArrayReadable(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    unsigned long i;
+
+    hm = hashmapq_new_with_flags(__uint_hash, __uint_compare, 64,
+                                 HASHMAPQ_INCREMENTAL_RESIZE);
+    for (i = 1; i <= 33; i++)
+        hashmapq_put(hm, (void *) i, (void *) (i + 100));
+
+    /* the put that crossed the threshold only swapped in a bigger array */
+    CuAssertTrue(tc, 128 == hashmapq_size(hm));
+    CuAssertTrue(tc, NULL != hm->array_old);
+    CuAssertTrue(tc, 33 == hashmapq_count(hm));
+
+    for (i = 1; i <= 33; i++)
+        CuAssertTrue(tc, i + 100 == (unsigned long) hashmapq_get(hm, (void *) i));
+
+    /* a few operations later the old array is gone */
+    CuAssertTrue(tc, NULL == hm->array_old);
+    CuAssertTrue(tc, 33 == hashmapq_count(hm));
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqQuadratic_IncrementalResizePutAndRemoveDuringMigration(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+
+    hm = hashmapq_new_with_flags(__uint_hash, __uint_compare, 4,
+                                 HASHMAPQ_INCREMENTAL_RESIZE |
+                                 HASHMAPQ_STORE_HASH);
+    hashmapq_put(hm, (void *) 1, (void *) 90);
+    hashmapq_put(hm, (void *) 5, (void *) 91);
+    hashmapq_put(hm, (void *) 2, (void *) 92);
+    CuAssertTrue(tc, NULL != hm->array_old);
+
+    CuAssertTrue(tc, 90 == (unsigned long)
+                 hashmapq_put(hm, (void *) 1, (void *) 80));
+    CuAssertTrue(tc, 91 == (unsigned long) hashmapq_remove(hm, (void *) 5));
+    CuAssertTrue(tc, 2 == hashmapq_count(hm));
+    CuAssertTrue(tc, 80 == (unsigned long) hashmapq_get(hm, (void *) 1));
+    CuAssertTrue(tc, 92 == (unsigned long) hashmapq_get(hm, (void *) 2));
+    CuAssertTrue(tc, NULL == hashmapq_get(hm, (void *) 5));
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqQuadratic_IncrementalResizeClearDuringMigration(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    unsigned long i;
+
+    hm = hashmapq_new_with_flags(__uint_hash, __uint_compare, 64,
+                                 HASHMAPQ_INCREMENTAL_RESIZE);
+    for (i = 1; i <= 33; i++)
+        hashmapq_put(hm, (void *) i, (void *) i);
+    CuAssertTrue(tc, NULL != hm->array_old);
+
+    hashmapq_clear(hm);
+    CuAssertTrue(tc, 0 == hashmapq_count(hm));
+    CuAssertTrue(tc, NULL == hm->array_old);
+    CuAssertTrue(tc, NULL == hashmapq_get(hm, (void *) 1));
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqQuadratic_PutOverTombstoneDoesNotDuplicateKey(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+
+    hm = hashmapq_new(__uint_hash, __uint_compare, 8);
+    /*  the following 2 collide: */
+    hashmapq_put(hm, (void *) 1, (void *) 92);
+    hashmapq_put(hm, (void *) 9, (void *) 93);
+    hashmapq_remove(hm, (void *) 1);
+
+    CuAssertTrue(tc, 93 == (unsigned long)
+                 hashmapq_put(hm, (void *) 9, (void *) 94));
+    CuAssertTrue(tc, 1 == hashmapq_count(hm));
+    CuAssertTrue(tc, 94 == (unsigned long) hashmapq_remove(hm, (void *) 9));
+    CuAssertTrue(tc, NULL == hashmapq_get(hm, (void *) 9));
+    CuAssertTrue(tc, 0 == hashmapq_count(hm));
+
+    hashmapq_put(hm, (void *) 17, (void *) 95);
+    CuAssertTrue(tc, 1 == hashmapq_count(hm));
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqQuadratic_ChurnDoesNotGrowArray(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    unsigned long i;
+
+    hm = hashmapq_new(__uint_hash, __uint_compare, 64);
+    for (i = 1; i <= 10; i++)
+        hashmapq_put(hm, (void *) i, (void *) i);
+
+    for (i = 11; i <= 10000; i++)
+    {
+        hashmapq_put(hm, (void *) i, (void *) i);
+        hashmapq_remove(hm, (void *) (i - 10));
+    }
+
+    CuAssertTrue(tc, 10 == hashmapq_count(hm));
+    CuAssertTrue(tc, 64 == hashmapq_size(hm));
+    for (i = 9991; i <= 10000; i++)
+        CuAssertTrue(tc, i == (unsigned long) hashmapq_get(hm, (void *) i));
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqQuadratic_CompactRemovesTombstones(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    unsigned long i;
+
+    hm = hashmapq_new_with_flags(__counting_hash, __uint_compare, 64,
+                                 HASHMAPQ_STORE_HASH);
+    for (i = 1; i <= 30; i++)
+        hashmapq_put(hm, (void *) (i * 8), (void *) i);
+    for (i = 1; i <= 30; i += 2)
+        hashmapq_remove(hm, (void *) (i * 8));
+
+    __hash_calls = 0;
+    hashmapq_compact(hm);
+    CuAssertTrue(tc, 0 == __hash_calls);
+    CuAssertTrue(tc, 15 == hashmapq_count(hm));
+    CuAssertTrue(tc, hm->slots_used == hashmapq_count(hm));
+    CuAssertTrue(tc, 64 == hashmapq_size(hm));
+    for (i = 1; i <= 30; i++)
+        CuAssertTrue(tc, (i % 2 ? 0 : i) ==
+                     (unsigned long) hashmapq_get(hm, (void *) (i * 8)));
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqRobinHood_PutGetRemove(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+
+    hm = hashmapq_new_with_flags(__uint_hash, __uint_compare, 8,
+                                 HASHMAPQ_ROBIN_HOOD);
+    /*  the following 3 collide: */
+    hashmapq_put(hm, (void *) 1, (void *) 92);
+    hashmapq_put(hm, (void *) 9, (void *) 91);
+    hashmapq_put(hm, (void *) 17, (void *) 90);
+    hashmapq_put(hm, (void *) 2, (void *) 89);
+
+    CuAssertTrue(tc, 4 == hashmapq_count(hm));
+    CuAssertTrue(tc, 91 == (unsigned long) hashmapq_remove(hm, (void *) 9));
+    CuAssertTrue(tc, 3 == hashmapq_count(hm));
+    /* no tombstones: the rest of the cluster was shifted back */
+    CuAssertTrue(tc, 3 == hm->slots_used);
+    CuAssertTrue(tc, 92 == (unsigned long) hashmapq_get(hm, (void *) 1));
+    CuAssertTrue(tc, 90 == (unsigned long) hashmapq_get(hm, (void *) 17));
+    CuAssertTrue(tc, 89 == (unsigned long) hashmapq_get(hm, (void *) 2));
+    CuAssertTrue(tc, NULL == hashmapq_get(hm, (void *) 9));
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqRobinHood_RunsAtHighLoadFactor(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    unsigned long i;
+
+    hm = hashmapq_new_with_flags(__uint_hash, __uint_compare, 64,
+                                 HASHMAPQ_ROBIN_HOOD);
+    for (i = 1; i <= 56; i++)
+        hashmapq_put(hm, (void *) (i * 3), (void *) i);
+
+    CuAssertTrue(tc, 64 == hashmapq_size(hm));
+    hashmapq_put(hm, (void *) 1000, (void *) 1000);
+    CuAssertTrue(tc, 128 == hashmapq_size(hm));
+    for (i = 1; i <= 56; i++)
+        CuAssertTrue(tc, i == (unsigned long) hashmapq_get(hm, (void *) (i * 3)));
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqRobinHood_IterateAndRemoveDoesntBreakIteration(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    hashmapq_iterator_t iter;
+    unsigned long i, sum = 0;
+    void *key;
+
+    hm = hashmapq_new_with_flags(__uint_hash, __uint_compare, 16,
+                                 HASHMAPQ_ROBIN_HOOD);
+    /*  clusters that wrap around the end of the array: */
+    for (i = 1; i <= 4; i++)
+    {
+        hashmapq_put(hm, (void *) (i * 16 + 15), (void *) 1);
+        hashmapq_put(hm, (void *) (i * 16 + 1), (void *) 1);
+    }
+
+    hashmapq_iterator(hm, &iter);
+    while ((key = hashmapq_iterator_next(hm, &iter)))
+    {
+        sum += (unsigned long) key;
+        CuAssertTrue(tc, NULL != hashmapq_remove(hm, key));
+    }
+
+    CuAssertTrue(tc, (16 + 32 + 48 + 64) * 2 + 4 * 16 == sum);
+    CuAssertTrue(tc, 0 == hashmapq_count(hm));
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqQuadratic_GetBatch(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    void *keys[100], *vals[100];
+    unsigned long i;
+
+    hm = hashmapq_new(__uint_hash, __uint_compare, 8);
+    for (i = 1; i <= 50; i++)
+        hashmapq_put(hm, (void *) (i * 8), (void *) i);
+
+    for (i = 0; i < 100; i++)
+        keys[i] = (void *) (i * 8);
+    hashmapq_get_batch(hm, keys, 100, vals);
+
+    for (i = 0; i < 100; i++)
+        CuAssertTrue(tc, (1 <= i && i <= 50 ? i : 0) == (unsigned long) vals[i]);
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqQuadratic_PutBatch(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    void *keys[100], *vals[100], *old[100];
+    unsigned long i;
+
+    hm = hashmapq_new(__uint_hash, __uint_compare, 8);
+    hashmapq_put(hm, (void *) 8, (void *) 1000);
+
+    for (i = 0; i < 100; i++)
+    {
+        keys[i] = (void *) ((i + 1) * 8);
+        vals[i] = (void *) (i + 1);
+    }
+    hashmapq_put_batch(hm, keys, vals, 100, old);
+
+    CuAssertTrue(tc, 100 == hashmapq_count(hm));
+    CuAssertTrue(tc, 1000 == (unsigned long) old[0]);
+    CuAssertTrue(tc, NULL == old[1]);
+    for (i = 0; i < 100; i++)
+        CuAssertTrue(tc, i + 1 == (unsigned long) hashmapq_get(hm, keys[i]));
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqQuadratic_WithHashDoesNotCallHash(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+
+    hm = hashmapq_new(__counting_hash, __uint_compare, 8);
+    __hash_calls = 0;
+    hashmapq_put_with_hash(hm, (void *) 50, (void *) 92, 50);
+    CuAssertTrue(tc, 92 == (unsigned long)
+                 hashmapq_get_with_hash(hm, (void *) 50, 50));
+    CuAssertTrue(tc, 1 == hashmapq_contains_key_with_hash(hm, (void *) 50, 50));
+    CuAssertTrue(tc, 92 == (unsigned long)
+                 hashmapq_remove_with_hash(hm, (void *) 50, 50));
+    CuAssertTrue(tc, 0 == __hash_calls);
+    CuAssertTrue(tc, 0 == hashmapq_count(hm));
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqQuadratic_WithHashWorksWithoutHashCallback(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    unsigned long i;
+
+    hm = hashmapq_new(NULL, __uint_compare, 4);
+    for (i = 1; i <= 100; i++)
+        hashmapq_put_with_hash(hm, (void *) i, (void *) i, i * 7);
+    for (i = 1; i <= 100; i += 2)
+        hashmapq_remove_with_hash(hm, (void *) i, i * 7);
+
+    CuAssertTrue(tc, 50 == hashmapq_count(hm));
+    for (i = 1; i <= 100; i++)
+        CuAssertTrue(tc, (i % 2 ? 0 : i) == (unsigned long)
+                     hashmapq_get_with_hash(hm, (void *) i, i * 7));
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqQuadratic_GetOrPutInsertsOnce(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    void **val;
+    int inserted;
+
+    hm = hashmapq_new(__counting_hash, __counting_compare, 8);
+
+    val = hashmapq_get_or_put(hm, (void *) 50, (void *) 1, &inserted);
+    CuAssertTrue(tc, 1 == inserted);
+    CuAssertTrue(tc, 1 == (unsigned long) *val);
+
+    __hash_calls = 0;
+    __compare_calls = 0;
+    val = hashmapq_get_or_put(hm, (void *) 50, (void *) 1, &inserted);
+    CuAssertTrue(tc, 0 == inserted);
+    *val = (void *) ((unsigned long) *val + 1);
+    CuAssertTrue(tc, 1 == __hash_calls);
+    CuAssertTrue(tc, 1 == __compare_calls);
+
+    CuAssertTrue(tc, 2 == (unsigned long) hashmapq_get(hm, (void *) 50));
+    CuAssertTrue(tc, 1 == hashmapq_count(hm));
+    CuAssertTrue(tc, NULL == hashmapq_get_or_put(hm, NULL, (void *) 1, NULL));
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqRobinHood_GetOrPutReturnsNewKeysSlot(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    unsigned long i;
+
+    hm = hashmapq_new_with_flags(__uint_hash, __uint_compare, 64,
+                                 HASHMAPQ_ROBIN_HOOD);
+    /* each insert displaces the cluster that follows it */
+    for (i = 1; i <= 40; i++)
+        hashmapq_put(hm, (void *) (i + 1), (void *) 1);
+    for (i = 1; i <= 10; i++)
+    {
+        void **val;
+
+        val = hashmapq_get_or_put(hm, (void *) (i * 64 + 1), (void *) 1, NULL);
+        *val = (void *) (i * 64 + 1);
+    }
+
+    for (i = 1; i <= 10; i++)
+        CuAssertTrue(tc, i * 64 + 1 == (unsigned long)
+                     hashmapq_get(hm, (void *) (i * 64 + 1)));
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqConcurrent_PutGetRemove(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    unsigned long i;
+
+    hm = hashmapq_new_with_flags(__uint_hash, __uint_compare, 4,
+                                 HASHMAPQ_CONCURRENT_READS);
+    for (i = 1; i <= 200; i++)
+        hashmapq_put(hm, (void *) i, (void *) (i + 1000));
+    for (i = 1; i <= 200; i += 2)
+        hashmapq_remove(hm, (void *) i);
+
+    CuAssertTrue(tc, 100 == hashmapq_count(hm));
+    for (i = 1; i <= 200; i++)
+        CuAssertTrue(tc, (i % 2 ? 0 : i + 1000) ==
+                     (unsigned long) hashmapq_get(hm, (void *) i));
+
+    /* removed slots are only reclaimed by a rehash */
+    hashmapq_compact(hm);
+    CuAssertTrue(tc, 100 == hashmapq_count(hm));
+    CuAssertTrue(tc, 1002 == (unsigned long) hashmapq_get(hm, (void *) 2));
+
+    hashmapq_clear(hm);
+    CuAssertTrue(tc, 0 == hashmapq_count(hm));
+    CuAssertTrue(tc, NULL == hashmapq_get(hm, (void *) 2));
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqConcurrent_ReadersProbeTheWholeChain(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    unsigned long i;
+
+    /* all 12 keys share a home slot; the 12th is 16 probes along */
+    hm = hashmapq_new_with_load_factors(__uint_hash, __uint_compare, 16,
+                                        HASHMAPQ_CONCURRENT_READS, 0.75, 0);
+    for (i = 1; i <= 12; i++)
+        hashmapq_put(hm, (void *) (i * 16), (void *) i);
+
+    CuAssertTrue(tc, 16 == hashmapq_size(hm));
+    for (i = 1; i <= 12; i++)
+        CuAssertTrue(tc, i == (unsigned long) hashmapq_get(hm,
+                                                           (void *) (i * 16)));
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqConcurrent_IteratorKeepsItsArray(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    hashmapq_iterator_t iter;
+    unsigned long i, n = 0;
+    int token;
+
+    hm = hashmapq_new_with_flags(__uint_hash, __uint_compare, 8,
+                                 HASHMAPQ_CONCURRENT_READS);
+    for (i = 1; i <= 3; i++)
+        hashmapq_put(hm, (void *) i, (void *) i);
+
+    token = hashmapq_read_begin(hm);
+    hashmapq_iterator(hm, &iter);
+    while (hashmapq_iterator_has_next(hm, &iter))
+    {
+        CuAssertTrue(tc, NULL != hashmapq_iterator_next_value(hm, &iter));
+        n++;
+    }
+    hashmapq_read_end(hm, token);
+    CuAssertTrue(tc, 3 == n);
+    hashmapq_freeall(hm);
+}
+
+#define CONCURRENT_KEYS 20000
+/* holds the highest key inserted so far */
+#define CONCURRENT_LAST (CONCURRENT_KEYS + 1)
+
+static void *__concurrent_reader(
+    void *arg
+)
+{
+    hashmapq_t *hm = arg;
+    unsigned long i, misses = 0, last = 0;
+
+    /* every key the writer has published must be found */
+    for (i = 1; last < CONCURRENT_KEYS; i++)
+    {
+        unsigned long k;
+
+        last = (unsigned long) hashmapq_get(hm, (void *) CONCURRENT_LAST);
+        if (!last)
+            continue;
+
+        k = 1 + (i * 7919) % last;
+        if (k != (unsigned long) hashmapq_get(hm, (void *) k))
+            misses++;
+    }
+    return (void *) misses;
+}
+
+void TesthashmapqConcurrent_ReadersSeeEveryPublishedKey(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    pthread_t readers[4];
+    unsigned long i;
+    int ii;
+
+    hm = hashmapq_new_with_flags(__uint_hash, __uint_compare, 4,
+                                 HASHMAPQ_CONCURRENT_READS);
+    for (ii = 0; ii < 4; ii++)
+        pthread_create(&readers[ii], NULL, __concurrent_reader, hm);
+
+    for (i = 1; i <= CONCURRENT_KEYS; i++)
+    {
+        hashmapq_put(hm, (void *) i, (void *) i);
+        hashmapq_put(hm, (void *) CONCURRENT_LAST, (void *) i);
+    }
+
+    for (ii = 0; ii < 4; ii++)
+    {
+        void *misses;
+
+        pthread_join(readers[ii], &misses);
+        CuAssertTrue(tc, NULL == misses);
+    }
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqLockFree_PutKeepsFirstValAndGrows(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    hashmapq_iterator_t iter;
+    unsigned long i, sum = 0;
+    void *key;
+
+    hm = hashmapq_new_with_flags(__uint_hash, __uint_compare, 4,
+                                 HASHMAPQ_LOCK_FREE);
+    for (i = 1; i <= 100; i++)
+        CuAssertTrue(tc, NULL == hashmapq_put(hm, (void *) i, (void *) i));
+    CuAssertTrue(tc, 1 == (unsigned long)
+                 hashmapq_put(hm, (void *) 1, (void *) 2));
+    CuAssertTrue(tc, 1 == (unsigned long) hashmapq_get(hm, (void *) 1));
+    CuAssertTrue(tc, 100 == hashmapq_count(hm));
+    CuAssertTrue(tc, 256 == hashmapq_size(hm));
+
+    hashmapq_iterator(hm, &iter);
+    while ((key = hashmapq_iterator_next(hm, &iter)))
+        sum += (unsigned long) key;
+    CuAssertTrue(tc, 5050 == sum);
+
+    hashmapq_clear(hm);
+    CuAssertTrue(tc, 0 == hashmapq_count(hm));
+    CuAssertTrue(tc, NULL == hashmapq_get(hm, (void *) 1));
+    hashmapq_freeall(hm);
+}
+
+#define LOCK_FREE_THREADS 8
+#define LOCK_FREE_KEYS 20000
+
+static void *__lock_free_dedup(
+    void *arg
+)
+{
+    hashmapq_t *hm = arg;
+    unsigned long i, inserted = 0;
+
+    /* every thread offers every key; exactly one of them gets it in */
+    for (i = 1; i <= LOCK_FREE_KEYS; i++)
+        if (!hashmapq_put(hm, (void *) i, (void *) i))
+            inserted++;
+    return (void *) inserted;
+}
+
+void TesthashmapqLockFree_ConcurrentPutsInsertEachKeyOnce(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    pthread_t threads[LOCK_FREE_THREADS];
+    unsigned long i, inserted = 0;
+    int ii;
+
+    hm = hashmapq_new_with_flags(__uint_hash, __uint_compare, 4,
+                                 HASHMAPQ_LOCK_FREE);
+    for (ii = 0; ii < LOCK_FREE_THREADS; ii++)
+        pthread_create(&threads[ii], NULL, __lock_free_dedup, hm);
+    for (ii = 0; ii < LOCK_FREE_THREADS; ii++)
+    {
+        void *n;
+
+        pthread_join(threads[ii], &n);
+        inserted += (unsigned long) n;
+    }
+
+    CuAssertTrue(tc, LOCK_FREE_KEYS == inserted);
+    CuAssertTrue(tc, LOCK_FREE_KEYS == hashmapq_count(hm));
+    for (i = 1; i <= LOCK_FREE_KEYS; i++)
+        CuAssertTrue(tc, i == (unsigned long) hashmapq_get(hm, (void *) i));
+    hashmapq_freeall(hm);
+}
+
+typedef struct
+{
+    int live;
+    int allocs;
+} __arena_t;
+
+static void *__arena_alloc(
+    size_t size,
+    void *udata
+)
+{
+    __arena_t *a = udata;
+
+    a->live++;
+    a->allocs++;
+    return malloc(size);
+}
+
+static void *__arena_realloc(
+    void *ptr,
+    size_t size,
+    void *udata
+)
+{
+    (void) udata;
+    return realloc(ptr, size);
+}
+
+static void __arena_free(
+    void *ptr,
+    void *udata
+)
+{
+    __arena_t *a = udata;
+
+    a->live--;
+    free(ptr);
+}
+
+void TesthashmapqQuadratic_AllocatorIsUsedForEverything(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    __arena_t arena = { 0, 0 };
+    hashmapq_allocator_t allocator = {
+        __arena_alloc, __arena_realloc, __arena_free, &arena
+    };
+    unsigned long i;
+
+    hm = hashmapq_new_with_allocator(__uint_hash, __uint_compare, 4,
+                                     HASHMAPQ_STORE_HASH, &allocator);
+    for (i = 1; i <= 100; i++)
+        hashmapq_put(hm, (void *) i, (void *) i);
+    for (i = 1; i <= 100; i++)
+        CuAssertTrue(tc, i == (unsigned long) hashmapq_get(hm, (void *) i));
+
+    CuAssertTrue(tc, 3 < arena.allocs);
+    hashmapq_freeall(hm);
+    CuAssertTrue(tc, 0 == arena.live);
+}
+
+void TesthashmapqQuadratic_FixedBufferReportsFull(
+    CuTest * tc
+)
+{
+    hashmapq_t hm;
+    void *buf, *keys[2] = { (void *) 5, (void *) 13 }, *olds[2];
+    unsigned long i;
+
+    buf = malloc(hashmapq_buffer_size(16, 0));
+    hashmapq_init_in_buffer(&hm, __uint_hash, __uint_compare, 16, 0, buf);
+
+    for (i = 1; i <= 8; i++)
+        CuAssertTrue(tc, NULL == hashmapq_put(&hm, (void *) i, (void *) i));
+    CuAssertTrue(tc, HASHMAPQ_FULL == hashmapq_put(&hm, (void *) 9, (void *) 9));
+    CuAssertTrue(tc, NULL == hashmapq_get_or_put(&hm, (void *) 9, (void *) 9,
+                                                 NULL));
+
+    /* keys already in the map can still be updated */
+    CuAssertTrue(tc, 1 == (unsigned long)
+                 hashmapq_put(&hm, (void *) 1, (void *) 10));
+    CuAssertTrue(tc, 10 == (unsigned long) hashmapq_get(&hm, (void *) 1));
+    CuAssertTrue(tc, 16 == hashmapq_size(&hm));
+
+    /* removing makes room again */
+    for (i = 1; i <= 4; i++)
+        hashmapq_remove(&hm, (void *) i);
+    for (i = 9; i <= 12; i++)
+        CuAssertTrue(tc, NULL == hashmapq_put(&hm, (void *) i, (void *) i));
+    CuAssertTrue(tc, 8 == hashmapq_count(&hm));
+    for (i = 5; i <= 12; i++)
+        CuAssertTrue(tc, i == (unsigned long) hashmapq_get(&hm, (void *) i));
+    CuAssertTrue(tc, 16 == hashmapq_size(&hm));
+
+    /* a batch reports which keys didn't fit */
+    hashmapq_put_batch(&hm, keys, keys, 2, olds);
+    CuAssertTrue(tc, 5 == (unsigned long) olds[0]);
+    CuAssertTrue(tc, HASHMAPQ_FULL == olds[1]);
+    CuAssertTrue(tc, NULL == hashmapq_get(&hm, (void *) 13));
+
+    free(buf);
+}
+
+void TesthashmapqQuadratic_BuildIntoFullFixedBufferDropsTheRest(
+    CuTest * tc
+)
+{
+    hashmapq_t hm;
+    hash_entry_t entries[12];
+    void *buf;
+    unsigned long i;
+
+    buf = malloc(hashmapq_buffer_size(16, 0));
+    hashmapq_init_in_buffer(&hm, __uint_hash, __uint_compare, 16, 0, buf);
+
+    for (i = 1; i <= 12; i++)
+    {
+        entries[i - 1].key = (void *) i;
+        entries[i - 1].val = (void *) (i + 100);
+    }
+    hashmapq_build(&hm, entries, 12);
+
+    CuAssertTrue(tc, 8 == hashmapq_count(&hm));
+    for (i = 1; i <= 8; i++)
+        CuAssertTrue(tc, i + 100 == (unsigned long) hashmapq_get(&hm,
+                                                                 (void *) i));
+    for (i = 9; i <= 12; i++)
+        CuAssertTrue(tc, NULL == hashmapq_get(&hm, (void *) i));
+
+    /* keys already in the map are still updated */
+    entries[0].val = (void *) 1000;
+    hashmapq_build(&hm, entries, 1);
+    CuAssertTrue(tc, 1000 == (unsigned long) hashmapq_get(&hm, (void *) 1));
+
+    free(buf);
+}
+
+void TesthashmapqQuadratic_FastClearEmptiesMap(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    unsigned long i, round;
+
+    hm = hashmapq_new_with_flags(__uint_hash, __uint_compare, 4,
+                                 HASHMAPQ_FAST_CLEAR);
+    for (i = 1; i <= 1000; i++)
+        hashmapq_put(hm, (void *) i, (void *) i);
+    hashmapq_clear(hm);
+    CuAssertTrue(tc, 0 == hashmapq_count(hm));
+    for (i = 1; i <= 1000; i++)
+        CuAssertTrue(tc, NULL == hashmapq_get(hm, (void *) i));
+
+    /* small jobs on the big array */
+    for (round = 0; round < 10; round++)
+    {
+        for (i = 1; i <= 10; i++)
+            hashmapq_put(hm, (void *) (i * 97 + round), (void *) i);
+        hashmapq_remove(hm, (void *) (97 + round));
+        CuAssertTrue(tc, 9 == hashmapq_count(hm));
+        CuAssertTrue(tc, 2 == (unsigned long)
+                     hashmapq_get(hm, (void *) (2 * 97 + round)));
+        hashmapq_clear(hm);
+        CuAssertTrue(tc, NULL == hashmapq_get(hm, (void *) (2 * 97 + round)));
+    }
+    CuAssertTrue(tc, 2048 == hashmapq_size(hm));
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqQuadratic_ShrinkOnClear(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    unsigned long i;
+    int round;
+
+    hm = hashmapq_new_with_flags(__uint_hash, __uint_compare, 16,
+                                 HASHMAPQ_FAST_CLEAR |
+                                 HASHMAPQ_SHRINK_ON_CLEAR);
+    for (i = 1; i <= 1000; i++)
+        hashmapq_put(hm, (void *) i, (void *) i);
+    hashmapq_clear(hm);
+    CuAssertTrue(tc, 2048 == hashmapq_size(hm));
+
+    for (round = 0; round < 8; round++)
+    {
+        for (i = 1; i <= 20; i++)
+            hashmapq_put(hm, (void *) i, (void *) i);
+        hashmapq_clear(hm);
+    }
+
+    /* the big job was in the last window; only small ones since */
+    CuAssertTrue(tc, 2048 == hashmapq_size(hm));
+    for (round = 0; round < 8; round++)
+    {
+        for (i = 1; i <= 20; i++)
+            hashmapq_put(hm, (void *) i, (void *) i);
+        hashmapq_clear(hm);
+    }
+    CuAssertTrue(tc, 128 == hashmapq_size(hm));
+
+    for (i = 1; i <= 50; i++)
+        hashmapq_put(hm, (void *) i, (void *) i);
+    for (i = 1; i <= 50; i++)
+        CuAssertTrue(tc, i == (unsigned long) hashmapq_get(hm, (void *) i));
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqQuadratic_ShrinkOnClearIgnoresReplacedKeys(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    unsigned long i;
+    int round;
+
+    hm = hashmapq_new_with_load_factors(__uint_hash, __uint_compare, 16,
+                                        HASHMAPQ_FAST_CLEAR |
+                                        HASHMAPQ_SHRINK_ON_CLEAR, 0.5, 0);
+    for (i = 1; i <= 12; i++)
+        hashmapq_put(hm, (void *) i, (void *) i);
+    CuAssertTrue(tc, 32 == hashmapq_size(hm));
+    for (round = 0; round < 8; round++)
+        hashmapq_clear(hm);
+    CuAssertTrue(tc, 32 == hashmapq_size(hm));
+
+    /* 3 keys are under a quarter of 16, however often they're replaced */
+    for (round = 0; round < 8; round++)
+    {
+        for (i = 1; i <= 3; i++)
+            hashmapq_put(hm, (void *) i, (void *) i);
+        hashmapq_put(hm, (void *) 3, (void *) 4);
+        hashmapq_clear(hm);
+    }
+    CuAssertTrue(tc, 16 == hashmapq_size(hm));
+    hashmapq_freeall(hm);
+}
+
+static int __sum_visit(
+    void *key,
+    void *val,
+    void *udata
+)
+{
+    unsigned long *sums = udata;
+
+    sums[0] += (unsigned long) key;
+    sums[1] += (unsigned long) val;
+    sums[2]++;
+    return 0;
+}
+
+static int __stop_at_3(
+    void *key,
+    void *val,
+    void *udata
+)
+{
+    (void) val;
+    (*(int *) udata)++;
+    return 3 == (unsigned long) key ? 7 : 0;
+}
+
+void TesthashmapqQuadratic_ForEachVisitsEveryEntry(
+    CuTest * tc
+)
+{
+    const int flagsets[] = {
+        0,
+        HASHMAPQ_OCCUPANCY_BITMAP,
+        HASHMAPQ_OCCUPANCY_BITMAP | HASHMAPQ_ROBIN_HOOD,
+        HASHMAPQ_OCCUPANCY_BITMAP | HASHMAPQ_FAST_CLEAR |
+            HASHMAPQ_INCREMENTAL_RESIZE,
+    };
+    unsigned int f;
+
+    for (f = 0; f < sizeof(flagsets) / sizeof(flagsets[0]); f++)
+    {
+        hashmapq_t *hm;
+        unsigned long i, sums[3] = { 0 };
+        int visited = 0;
+
+        hm = hashmapq_new_with_flags(__uint_hash, __uint_compare, 4,
+                                     flagsets[f]);
+        for (i = 1; i <= 500; i++)
+            hashmapq_put(hm, (void *) i, (void *) (i * 2));
+        /* removed keys aren't visited */
+        for (i = 2; i <= 500; i += 2)
+            hashmapq_remove(hm, (void *) i);
+
+        CuAssertTrue(tc, 0 == hashmapq_for_each(hm, __sum_visit, sums));
+        CuAssertTrue(tc, 250 == sums[2]);
+        CuAssertTrue(tc, 250 * 250 == sums[0]);
+        CuAssertTrue(tc, 2 * 250 * 250 == sums[1]);
+
+        /* a non-zero return stops the walk */
+        CuAssertTrue(tc, 7 == hashmapq_for_each(hm, __stop_at_3, &visited));
+        CuAssertTrue(tc, 1 <= visited && visited <= 250);
+
+        hashmapq_clear(hm);
+        sums[2] = 0;
+        hashmapq_for_each(hm, __sum_visit, sums);
+        CuAssertTrue(tc, 0 == sums[2]);
+        hashmapq_freeall(hm);
+    }
+}
+
+void TesthashmapqQuadratic_IteratorNextEntry(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    hashmapq_iterator_t iter;
+    hash_entry_t entry;
+    unsigned long i, n = 0;
+
+    hm = hashmapq_new(__uint_hash, __uint_compare, 8);
+    for (i = 1; i <= 100; i++)
+        hashmapq_put(hm, (void *) i, (void *) (i + 1000));
+
+    hashmapq_iterator(hm, &iter);
+    while (hashmapq_iterator_next_entry(hm, &iter, &entry))
+    {
+        CuAssertTrue(tc, (unsigned long) entry.key + 1000 ==
+                     (unsigned long) entry.val);
+        n++;
+    }
+    CuAssertTrue(tc, 100 == n);
+    CuAssertTrue(tc, 0 == hashmapq_iterator_next_entry(hm, &iter, &entry));
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqQuadratic_MaxLoadFactorControlsGrowth(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    unsigned long i;
+
+    hm = hashmapq_new_with_load_factors(__uint_hash, __uint_compare, 16, 0,
+                                        0.75, 0);
+    for (i = 1; i <= 11; i++)
+        hashmapq_put(hm, (void *) i, (void *) i);
+    CuAssertTrue(tc, 16 == hashmapq_size(hm));
+    hashmapq_put(hm, (void *) 12, (void *) 12);
+    hashmapq_put(hm, (void *) 13, (void *) 13);
+    CuAssertTrue(tc, 32 == hashmapq_size(hm));
+    hashmapq_freeall(hm);
+
+    hm = hashmapq_new_with_load_factors(__uint_hash, __uint_compare, 16, 0,
+                                        0.25, 0);
+    for (i = 1; i <= 5; i++)
+        hashmapq_put(hm, (void *) i, (void *) i);
+    CuAssertTrue(tc, 32 == hashmapq_size(hm));
+    for (i = 1; i <= 5; i++)
+        CuAssertTrue(tc, i == (unsigned long) hashmapq_get(hm, (void *) i));
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqQuadratic_MaxLoadFactorLimit(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    unsigned long i;
+
+    /* 0.75 is the most a quadratic probed map takes; fill one chain to it */
+    hm = hashmapq_new_with_load_factors(__uint_hash, __uint_compare, 16, 0,
+                                        0.75, 0);
+    for (i = 1; i <= 12; i++)
+        hashmapq_put(hm, (void *) (i * 16), (void *) i);
+    CuAssertTrue(tc, 16 == hashmapq_size(hm));
+    for (i = 1; i <= 12; i++)
+        CuAssertTrue(tc, i == (unsigned long) hashmapq_get(hm,
+                                                           (void *) (i * 16)));
+    hashmapq_freeall(hm);
+
+    /* Robin Hood probes linearly, so it can go higher */
+    hm = hashmapq_new_with_load_factors(__uint_hash, __uint_compare, 16,
+                                        HASHMAPQ_ROBIN_HOOD, 0.9, 0);
+    for (i = 1; i <= 14; i++)
+        hashmapq_put(hm, (void *) i, (void *) i);
+    CuAssertTrue(tc, 16 == hashmapq_size(hm));
+    for (i = 1; i <= 14; i++)
+        CuAssertTrue(tc, i == (unsigned long) hashmapq_get(hm, (void *) i));
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqQuadratic_MinLoadFactorShrinksOnRemove(
+    CuTest * tc
+)
+{
+    const int flagsets[] = {
+        0, HASHMAPQ_ROBIN_HOOD, HASHMAPQ_INCREMENTAL_RESIZE,
+        HASHMAPQ_CONCURRENT_READS, HASHMAPQ_OCCUPANCY_BITMAP,
+    };
+    unsigned int f;
+
+    for (f = 0; f < sizeof(flagsets) / sizeof(flagsets[0]); f++)
+    {
+        hashmapq_t *hm;
+        unsigned long i;
+
+        hm = hashmapq_new_with_load_factors(__uint_hash, __uint_compare, 8,
+                                            flagsets[f], 0.5, 0.125);
+        for (i = 1; i <= 1000; i++)
+            hashmapq_put(hm, (void *) i, (void *) i);
+        CuAssertTrue(tc, 2048 <= hashmapq_size(hm));
+
+        for (i = 1; i <= 990; i++)
+            CuAssertTrue(tc, i == (unsigned long) hashmapq_remove(hm, (void *) i));
+        /* 10 keys left; anything incremental finishes on the next calls */
+        for (i = 991; i <= 1000; i++)
+            CuAssertTrue(tc, i == (unsigned long) hashmapq_get(hm, (void *) i));
+        CuAssertTrue(tc, 128 >= hashmapq_size(hm));
+
+        /* never below the initial capacity */
+        for (i = 991; i <= 1000; i++)
+            hashmapq_remove(hm, (void *) i);
+        CuAssertTrue(tc, 0 == hashmapq_count(hm));
+        CuAssertTrue(tc, 8 == hashmapq_size(hm));
+
+        for (i = 1; i <= 100; i++)
+            hashmapq_put(hm, (void *) i, (void *) (i + 1));
+        for (i = 1; i <= 100; i++)
+            CuAssertTrue(tc, i + 1 == (unsigned long) hashmapq_get(hm, (void *) i));
+        hashmapq_freeall(hm);
+    }
+}
+
+void TesthashmapqQuadratic_ReserveSizesOnce(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm;
+    unsigned long i;
+
+    hm = hashmapq_new(__uint_hash, __uint_compare, 4);
+    hashmapq_reserve(hm, 1000);
+    CuAssertTrue(tc, 2048 == hashmapq_size(hm));
+    for (i = 1; i <= 1000; i++)
+        hashmapq_put(hm, (void *) i, (void *) i);
+    CuAssertTrue(tc, 2048 == hashmapq_size(hm));
+
+    /* reserving less than we have is a no-op */
+    hashmapq_reserve(hm, 10);
+    CuAssertTrue(tc, 2048 == hashmapq_size(hm));
+    for (i = 1; i <= 1000; i++)
+        CuAssertTrue(tc, i == (unsigned long) hashmapq_get(hm, (void *) i));
+    hashmapq_freeall(hm);
+}
+
+void TesthashmapqQuadratic_BuildPutsEveryEntry(
+    CuTest * tc
+)
+{
+    const int flagsets[] = {
+        0, HASHMAPQ_ROBIN_HOOD, HASHMAPQ_INCREMENTAL_RESIZE,
+        HASHMAPQ_CONCURRENT_READS, HASHMAPQ_LOCK_FREE,
+    };
+    hash_entry_t entries[1001];
+    unsigned int f;
+    unsigned long i;
+
+    for (i = 0; i < 1000; i++)
+    {
+        entries[i].key = (void *) (i + 1);
+        entries[i].val = (void *) (i + 2);
+    }
+    /* the last duplicate wins */
+    entries[1000].key = (void *) 5;
+    entries[1000].val = (void *) 50;
+
+    for (f = 0; f < sizeof(flagsets) / sizeof(flagsets[0]); f++)
+    {
+        hashmapq_t *hm;
+
+        hm = hashmapq_new_with_flags(__uint_hash, __uint_compare, 4,
+                                     flagsets[f]);
+        hashmapq_put(hm, (void *) 2000, (void *) 1);
+        hashmapq_build(hm, entries, 1001);
+        CuAssertTrue(tc, 1001 == hashmapq_count(hm));
+        CuAssertTrue(tc, 1 == (unsigned long) hashmapq_get(hm, (void *) 2000));
+        for (i = 1; i <= 1000; i++)
+            if (5 != i && !(flagsets[f] & HASHMAPQ_LOCK_FREE))
+                CuAssertTrue(tc, i + 1 ==
+                             (unsigned long) hashmapq_get(hm, (void *) i));
+        /* lock-free puts keep the first val */
+        CuAssertTrue(tc, (flagsets[f] & HASHMAPQ_LOCK_FREE ? 6 : 50) ==
+                     (unsigned long) hashmapq_get(hm, (void *) 5));
+        hashmapq_freeall(hm);
+    }
+}
+
+void TesthashmapqQuadratic_BuildParallel(
+    CuTest * tc
+)
+{
+    const int flagsets[] = {
+        0, HASHMAPQ_STORE_HASH, HASHMAPQ_OCCUPANCY_BITMAP | HASHMAPQ_FAST_CLEAR,
+        HASHMAPQ_ROBIN_HOOD,
+    };
+    static hash_entry_t entries[20000];
+    unsigned int f;
+    unsigned long i;
+
+    for (i = 0; i < 20000; i++)
+    {
+        /* every key twice, with the same val */
+        entries[i].key = (void *) (i % 10000 + 1);
+        entries[i].val = (void *) (i % 10000 + 7);
+    }
+
+    for (f = 0; f < sizeof(flagsets) / sizeof(flagsets[0]); f++)
+    {
+        hashmapq_t *hm;
+        unsigned long sums[3] = { 0 };
+
+        hm = hashmapq_new_with_flags(__uint_hash, __uint_compare, 4,
+                                     flagsets[f]);
+        hashmapq_put(hm, (void *) 50000, (void *) 1);
+        hashmapq_put(hm, (void *) 3, (void *) 1);
+        hashmapq_build_parallel(hm, entries, 20000, 4);
+        CuAssertTrue(tc, 10001 == hashmapq_count(hm));
+        for (i = 1; i <= 10000; i++)
+            CuAssertTrue(tc, i + 6 == (unsigned long) hashmapq_get(hm, (void *) i));
+        CuAssertTrue(tc, 1 == (unsigned long) hashmapq_get(hm, (void *) 50000));
+
+        hashmapq_increase_capacity_parallel(hm, 3);
+        CuAssertTrue(tc, 10001 == hashmapq_count(hm));
+        for (i = 1; i <= 10000; i++)
+            CuAssertTrue(tc, i + 6 == (unsigned long) hashmapq_get(hm, (void *) i));
+
+        hashmapq_for_each(hm, __sum_visit, sums);
+        CuAssertTrue(tc, 10001 == sums[2]);
+
+        /* the map carries on as normal */
+        for (i = 1; i <= 10000; i += 2)
+            hashmapq_remove(hm, (void *) i);
+        for (i = 20001; i <= 30000; i++)
+            hashmapq_put(hm, (void *) i, (void *) i);
+        CuAssertTrue(tc, 15001 == hashmapq_count(hm));
+        hashmapq_clear(hm);
+        CuAssertTrue(tc, NULL == hashmapq_get(hm, (void *) 2));
+        hashmapq_freeall(hm);
+    }
+}
+
+static unsigned long __str_hash(
+    const void *key
+)
+{
+    const unsigned char *s = key;
+    unsigned long h = 5381;
+
+    while (*s)
+        h = h * 33 + *s++;
+    return h;
+}
+
+static long __str_compare(
+    const void *a,
+    const void *b
+)
+{
+    return strcmp(a, b);
+}
+
+static size_t __str_serialize(
+    const void *item,
+    void *buf,
+    size_t len
+)
+{
+    size_t need = strlen(item) + 1;
+
+    if (need <= len)
+        memcpy(buf, item, need);
+    return need;
+}
+
+static void __snapshot_path(
+    char *path
+)
+{
+    int fd;
+
+    strcpy(path, "/tmp/hashmapq_snapshotXXXXXX");
+    fd = mkstemp(path);
+    assert(-1 != fd);
+    close(fd);
+}
+
+void TesthashmapqQuadratic_SaveAndOpenMmap(
+    CuTest * tc
+)
+{
+    const int flagsets[] = { 0, HASHMAPQ_ROBIN_HOOD, HASHMAPQ_STORE_HASH,
+        HASHMAPQ_MIX_HASH };
+    char path[64];
+    unsigned int f;
+
+    __snapshot_path(path);
+
+    for (f = 0; f < sizeof(flagsets) / sizeof(flagsets[0]); f++)
+    {
+        hashmapq_t *hm, *mapped;
+        unsigned long i;
+        FILE *fp;
+
+        hm = hashmapq_new_with_flags(__uint_hash, __uint_compare, 8,
+                                     flagsets[f]);
+        for (i = 1; i <= 3000; i++)
+            hashmapq_put(hm, (void *) i, (void *) (i * 3));
+        /* tombstones are left out of the file */
+        for (i = 1; i <= 3000; i += 3)
+            hashmapq_remove(hm, (void *) i);
+
+        fp = fopen(path, "w+");
+        CuAssertTrue(tc, 0 == hashmapq_save(hm, fileno(fp), NULL, NULL));
+        fclose(fp);
+
+        mapped = hashmapq_open_mmap(path, __uint_hash, __uint_compare);
+        CuAssertTrue(tc, NULL != mapped);
+        CuAssertTrue(tc, 1 == hashmapq_verify_mmap(mapped));
+        CuAssertTrue(tc, hashmapq_count(hm) == hashmapq_count(mapped));
+        for (i = 1; i <= 3000; i++)
+            CuAssertTrue(tc, (unsigned long) hashmapq_get(hm, (void *) i) ==
+                         (unsigned long) hashmapq_get(mapped, (void *) i));
+        CuAssertTrue(tc, NULL == hashmapq_get(mapped, (void *) 5000));
+        hashmapq_freeall(mapped);
+        hashmapq_freeall(hm);
+    }
+
+    unlink(path);
+}
+
+void TesthashmapqQuadratic_MmapKeysAndValsAreBytes(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm, *mapped;
+    char path[64], keys[500][16], *big;
+    size_t big_len = 3 << 20;
+    FILE *fp;
+    int i;
+
+    __snapshot_path(path);
+
+    /* bigger than save's write buffer */
+    big = malloc(big_len);
+    memset(big, 'x', big_len - 1);
+    big[big_len - 1] = '\0';
+
+    hm = hashmapq_new(__str_hash, __str_compare, 8);
+    for (i = 0; i < 500; i++)
+    {
+        sprintf(keys[i], "key%d", i);
+        hashmapq_put(hm, keys[i], 250 == i ? big : keys[i]);
+    }
+
+    fp = fopen(path, "w+");
+    CuAssertTrue(tc, 0 == hashmapq_save(hm, fileno(fp), __str_serialize,
+                                        __str_serialize));
+    fclose(fp);
+    hashmapq_freeall(hm);
+
+    mapped = hashmapq_open_mmap(path, __str_hash, __str_compare);
+    CuAssertTrue(tc, NULL != mapped);
+    CuAssertTrue(tc, 1 == hashmapq_verify_mmap(mapped));
+    for (i = 0; i < 500; i++)
+    {
+        char key[16];
+        const char *val;
+
+        /* a different copy of the key finds it */
+        sprintf(key, "key%d", i);
+        val = hashmapq_get(mapped, key);
+        CuAssertTrue(tc, NULL != val);
+        CuAssertTrue(tc, 0 == strcmp(val, 250 == i ? big : key));
+    }
+    CuAssertTrue(tc, NULL == hashmapq_get(mapped, "nope"));
+    hashmapq_freeall(mapped);
+
+    /* a damaged body is caught by verify, a damaged header by open */
+    fp = fopen(path, "r+");
+    fseek(fp, -100, SEEK_END);
+    fputc('!', fp);
+    fclose(fp);
+    mapped = hashmapq_open_mmap(path, __str_hash, __str_compare);
+    CuAssertTrue(tc, NULL != mapped);
+    CuAssertTrue(tc, 0 == hashmapq_verify_mmap(mapped));
+    hashmapq_freeall(mapped);
+
+    fp = fopen(path, "r+");
+    fseek(fp, 20, SEEK_SET);
+    fputc('!', fp);
+    fclose(fp);
+    CuAssertTrue(tc, NULL == hashmapq_open_mmap(path, __str_hash,
+                                                __str_compare));
+
+    unlink(path);
+    free(big);
+}
+
+void TesthashmapqQuadratic_MmapGetBatch(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm, *mapped;
+    char path[64], keys[100][16];
+    void *batch[101], *vals[101];
+    FILE *fp;
+    int i;
+
+    __snapshot_path(path);
+
+    hm = hashmapq_new(__str_hash, __str_compare, 8);
+    for (i = 0; i < 100; i++)
+    {
+        sprintf(keys[i], "key%d", i);
+        hashmapq_put(hm, keys[i], keys[i]);
+    }
+
+    fp = fopen(path, "w+");
+    CuAssertTrue(tc, 0 == hashmapq_save(hm, fileno(fp), __str_serialize,
+                                        __str_serialize));
+    fclose(fp);
+    hashmapq_freeall(hm);
+
+    mapped = hashmapq_open_mmap(path, __str_hash, __str_compare);
+    CuAssertTrue(tc, NULL != mapped);
+    for (i = 0; i < 100; i++)
+        batch[i] = keys[99 - i];
+    batch[100] = "nope";
+    hashmapq_get_batch(mapped, batch, 101, vals);
+    for (i = 0; i < 100; i++)
+    {
+        CuAssertTrue(tc, NULL != vals[i]);
+        CuAssertTrue(tc, 0 == strcmp(vals[i], keys[99 - i]));
+    }
+    CuAssertTrue(tc, NULL == vals[100]);
+    hashmapq_freeall(mapped);
+
+    unlink(path);
+}
+
+void TesthashmapqQuadratic_RecoverFromCheckpointAndJournal(
+    CuTest * tc
+)
+{
+    const int flagsets[] = { 0, HASHMAPQ_ROBIN_HOOD,
+        HASHMAPQ_INCREMENTAL_RESIZE };
+    unsigned int f;
+
+    for (f = 0; f < sizeof(flagsets) / sizeof(flagsets[0]); f++)
+    {
+        FILE *journal = tmpfile(), *checkpoint = tmpfile();
+        hashmapq_t *hm, *recovered;
+        unsigned long i;
+
+        hm = hashmapq_new_with_flags(__uint_hash, __uint_compare, 8,
+                                     flagsets[f]);
+        hashmapq_journal_start(hm, fileno(journal), fileno(checkpoint),
+                               NULL, NULL);
+        for (i = 1; i <= 1000; i++)
+            hashmapq_put(hm, (void *) i, (void *) i);
+        hashmapq_clear(hm);
+        for (i = 1; i <= 2000; i++)
+            hashmapq_put(hm, (void *) i, (void *) (i * 3));
+        for (i = 1; i <= 2000; i += 3)
+            hashmapq_remove(hm, (void *) i);
+        CuAssertTrue(tc, 0 == hashmapq_journal_commit(hm));
+        CuAssertTrue(tc, 0 == hashmapq_checkpoint(hm));
+
+        /* only touches a few pages */
+        hashmapq_put(hm, (void *) 2, (void *) 99);
+        hashmapq_remove(hm, (void *) 5);
+        CuAssertTrue(tc, 0 == hashmapq_checkpoint(hm));
+
+        /* left in the journal */
+        for (i = 2001; i <= 2500; i++)
+            hashmapq_put(hm, (void *) i, (void *) (i * 3));
+        hashmapq_remove(hm, (void *) 8);
+        CuAssertTrue(tc, 0 == hashmapq_journal_stop(hm));
+
+        recovered = hashmapq_new_with_flags(__uint_hash, __uint_compare, 8,
+                                            flagsets[f]);
+        CuAssertTrue(tc, 0 == hashmapq_recover(recovered, fileno(journal),
+                                               fileno(checkpoint), NULL));
+        CuAssertTrue(tc, hashmapq_count(hm) == hashmapq_count(recovered));
+        for (i = 1; i <= 2600; i++)
+            CuAssertTrue(tc, hashmapq_get(hm, (void *) i) ==
+                         hashmapq_get(recovered, (void *) i));
+        CuAssertTrue(tc, 99 == (unsigned long) hashmapq_get(recovered,
+                                                            (void *) 2));
+
+        hashmapq_freeall(recovered);
+        hashmapq_freeall(hm);
+        fclose(journal);
+        fclose(checkpoint);
+    }
+}
+
+static void *__str_deserialize(
+    const void *buf,
+    size_t len
+)
+{
+    char *s = malloc(len);
+
+    memcpy(s, buf, len);
+    return s;
+}
+
+static int __free_entry(
+    void *key,
+    void *val,
+    void *udata
+)
+{
+    (void) udata;
+    free(key);
+    free(val);
+    return 0;
+}
+
+void TesthashmapqQuadratic_RecoverStopsAtTornRecord(
+    CuTest * tc
+)
+{
+    const hashmapq_deserializer_t d = { __str_deserialize, __str_deserialize,
+        free };
+    FILE *journal = tmpfile(), *checkpoint = tmpfile();
+    hashmapq_t *hm, *recovered;
+    long intact;
+
+    hm = hashmapq_new(__str_hash, __str_compare, 8);
+    hashmapq_journal_start(hm, fileno(journal), fileno(checkpoint),
+                           __str_serialize, __str_serialize);
+    hashmapq_put(hm, "a", "1");
+    hashmapq_put(hm, "b", "2");
+    hashmapq_put(hm, "a", "3");
+    CuAssertTrue(tc, 0 == hashmapq_journal_commit(hm));
+    intact = lseek(fileno(journal), 0, SEEK_END);
+    hashmapq_put(hm, "c", "4");
+    CuAssertTrue(tc, 0 == hashmapq_journal_stop(hm));
+    hashmapq_freeall(hm);
+
+    /* a crash part way through writing the last record */
+    CuAssertTrue(tc, 0 == ftruncate(fileno(journal),
+                                    lseek(fileno(journal), 0, SEEK_END) - 3));
+
+    recovered = hashmapq_new(__str_hash, __str_compare, 8);
+    CuAssertTrue(tc, 0 == hashmapq_recover(recovered, fileno(journal),
+                                           fileno(checkpoint), &d));
+    CuAssertTrue(tc, 2 == hashmapq_count(recovered));
+    CuAssertTrue(tc, 0 == strcmp("3", hashmapq_get(recovered, "a")));
+    CuAssertTrue(tc, 0 == strcmp("2", hashmapq_get(recovered, "b")));
+    CuAssertTrue(tc, NULL == hashmapq_get(recovered, "c"));
+    CuAssertTrue(tc, intact == lseek(fileno(journal), 0, SEEK_END));
+
+    /* journaling picks up after the last intact record */
+    hashmapq_journal_start(recovered, fileno(journal), fileno(checkpoint),
+                           __str_serialize, __str_serialize);
+    hashmapq_remove(recovered, "b");
+    CuAssertTrue(tc, 0 == hashmapq_journal_stop(recovered));
+    hashmapq_for_each(recovered, __free_entry, NULL);
+    hashmapq_freeall(recovered);
+
+    recovered = hashmapq_new(__str_hash, __str_compare, 8);
+    CuAssertTrue(tc, 0 == hashmapq_recover(recovered, fileno(journal),
+                                           fileno(checkpoint), &d));
+    CuAssertTrue(tc, 1 == hashmapq_count(recovered));
+    CuAssertTrue(tc, 0 == strcmp("3", hashmapq_get(recovered, "a")));
+    hashmapq_for_each(recovered, __free_entry, NULL);
+    hashmapq_freeall(recovered);
+
+    fclose(journal);
+    fclose(checkpoint);
+}
+
+void TesthashmapqQuadratic_BundledHashes(
+    CuTest * tc
+)
+{
+    const char *s = "message digest";
+    unsigned long i, low_bits = 0;
+
+    /* wyhash's own test vector */
+    CuAssertTrue(tc, 0x786d1f1df3801df4ull ==
+                 (unsigned long long) hashmapq_hash_bytes(s, strlen(s), 3));
+    CuAssertTrue(tc, hashmapq_hash_bytes(s, strlen(s), 0) ==
+                 hashmapq_hash_str(s));
+    CuAssertTrue(tc, hashmapq_hash_str("a") != hashmapq_hash_str("b"));
+
+    /* aligned pointers share their low bits; mixed, they don't */
+    for (i = 1; i <= 64; i++)
+        low_bits |= 1ul << (hashmapq_hash_ptr((void *) (i * 4096)) & 63);
+    CuAssertTrue(tc, 16 < __builtin_popcountl(low_bits));
+    CuAssertTrue(tc, hashmapq_mix(4096) == hashmapq_hash_ptr((void *) 4096));
+}
+
+void TesthashmapqQuadratic_MixHashAppliesToEveryHash(
+    CuTest * tc
+)
+{
+    const int flagsets[] = { HASHMAPQ_MIX_HASH,
+        HASHMAPQ_MIX_HASH | HASHMAPQ_ROBIN_HOOD,
+        HASHMAPQ_MIX_HASH | HASHMAPQ_INCREMENTAL_RESIZE,
+        HASHMAPQ_MIX_HASH | HASHMAPQ_CONCURRENT_READS };
+    unsigned int f;
+
+    for (f = 0; f < sizeof(flagsets) / sizeof(flagsets[0]); f++)
+    {
+        hashmapq_t *hm;
+        unsigned long i;
+
+        hm = hashmapq_new_with_flags(__uint_hash, __uint_compare, 8,
+                                     flagsets[f]);
+        /* the _with_hash variants take the callback's hash, unmixed */
+        for (i = 1; i <= 2000; i++)
+            hashmapq_put_with_hash(hm, (void *) (i * 4096), (void *) i,
+                                   i * 4096);
+        for (i = 1; i <= 2000; i++)
+            CuAssertTrue(tc, i == (unsigned long) hashmapq_get(hm,
+                                                   (void *) (i * 4096)));
+        for (i = 1; i <= 2000; i += 2)
+            CuAssertTrue(tc, i == (unsigned long) hashmapq_remove_with_hash(
+                             hm, (void *) (i * 4096), i * 4096));
+        for (i = 2; i <= 2000; i += 2)
+            CuAssertTrue(tc, i == (unsigned long) hashmapq_get_with_hash(
+                             hm, (void *) (i * 4096), i * 4096));
+        CuAssertTrue(tc, 1000 == hashmapq_count(hm));
+        hashmapq_freeall(hm);
+    }
+}
+
+static unsigned long __first_seed;
+
+/* collides every key under the first seed it sees, like a key set crafted
+ * against that seed */
+static unsigned long __flooded_hash(
+    const void *key,
+    unsigned long seed
+)
+{
+    if (!__first_seed)
+        __first_seed = seed;
+    return seed == __first_seed ? 0 : hashmapq_hash_ptr_seeded(key, seed);
+}
+
+static void __count_flood(
+    void *hmap,
+    int probes,
+    void *udata
+)
+{
+    (void) hmap;
+    (void) probes;
+    (*(int *) udata)++;
+}
+
+void TesthashmapqQuadratic_SeededMapReseedsWhenFlooded(
+    CuTest * tc
+)
+{
+    const int flagsets[] = { 0, HASHMAPQ_ROBIN_HOOD,
+        HASHMAPQ_INCREMENTAL_RESIZE };
+    unsigned int f;
+
+    for (f = 0; f < sizeof(flagsets) / sizeof(flagsets[0]); f++)
+    {
+        hashmapq_t *hm;
+        unsigned long i;
+        int floods = 0;
+
+        __first_seed = 0;
+        hm = hashmapq_new_seeded(__flooded_hash, __uint_compare, 8,
+                                 flagsets[f]);
+        hashmapq_set_flood_callback(hm, __count_flood, &floods);
+        for (i = 1; i <= 2000; i++)
+            hashmapq_put(hm, (void *) i, (void *) i);
+
+        CuAssertTrue(tc, 1 == floods);
+        CuAssertTrue(tc, __first_seed != hm->seed);
+        CuAssertTrue(tc, 2000 == hashmapq_count(hm));
+        for (i = 1; i <= 2000; i++)
+            CuAssertTrue(tc, i == (unsigned long) hashmapq_get(hm, (void *) i));
+        hashmapq_freeall(hm);
+    }
+}
+
+void TesthashmapqQuadratic_FloodCallbackWithoutSeed(
+    CuTest * tc
+)
+{
+    hashmapq_t *hm, *a, *b;
+    unsigned long i;
+    int floods = 0;
+
+    /* the identity hash puts keys with equal low bits on one chain */
+    hm = hashmapq_new(__uint_hash, __uint_compare, 8);
+    hashmapq_set_flood_callback(hm, __count_flood, &floods);
+    for (i = 1; i <= 200; i++)
+        hashmapq_put(hm, (void *) (i << 20), (void *) i);
+    CuAssertTrue(tc, 0 < floods);
+    for (i = 1; i <= 200; i++)
+        CuAssertTrue(tc, i == (unsigned long) hashmapq_get(hm,
+                                                           (void *) (i << 20)));
+    hashmapq_freeall(hm);
+
+    /* every map gets its own seed */
+    a = hashmapq_new_seeded(hashmapq_hash_str_seeded, __str_compare, 8, 0);
+    b = hashmapq_new_seeded(hashmapq_hash_str_seeded, __str_compare, 8, 0);
+    CuAssertTrue(tc, a->seed != b->seed);
+    hashmapq_put(a, "key", "val");
+    CuAssertTrue(tc, 0 == strcmp("val", hashmapq_get(a, "key")));
+    CuAssertTrue(tc, NULL == hashmapq_get(b, "key"));
+    hashmapq_freeall(a);
+    hashmapq_freeall(b);
+}
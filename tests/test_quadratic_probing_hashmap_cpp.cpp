@@ -0,0 +1,180 @@
+#include <memory>
+#include <string>
+#include <string_view>
+extern "C" {
+#include "CuTest.h"
+}
+
+#include "quadratic_probing_hashmap.hpp"
+
+struct string_hash
+{
+    using is_transparent = void;
+
+    std::size_t operator()(std::string_view s) const
+    {
+        return std::hash<std::string_view>()(s);
+    }
+};
+
+typedef qph::HashMap<std::string, int, string_hash, std::equal_to<>>
+    string_map_t;
+
+extern "C" {
+
+void TesthashmapqCpp_TryEmplaceAndFind(
+    CuTest * tc
+)
+{
+    qph::HashMap<unsigned long, unsigned long> hm;
+
+    CuAssertTrue(tc, hm.try_emplace(50, 92).second);
+    CuAssertTrue(tc, !hm.try_emplace(50, 23).second);
+    CuAssertTrue(tc, 1 == hm.size());
+    CuAssertTrue(tc, 92 == hm.find(50)->second);
+    CuAssertTrue(tc, hm.end() == hm.find(51));
+}
+
+void TesthashmapqCpp_TryEmplaceHitDoesNotGrow(
+    CuTest * tc
+)
+{
+    qph::HashMap<int, int> probe_map(8), hm(8);
+    int i, n = 0;
+
+    /* find how many items fit before the first growth */
+    while (probe_map.capacity() == hm.capacity())
+        probe_map.try_emplace(n++, 0);
+    n--;
+
+    for (i = 0; i < n; i++)
+        hm.try_emplace(i, i);
+
+    auto it = hm.find(0);
+    std::size_t cap = hm.capacity();
+
+    CuAssertTrue(tc, !hm.try_emplace(0, 99).second);
+    CuAssertTrue(tc, cap == hm.capacity());
+    CuAssertTrue(tc, 0 == it->second);
+    CuAssertTrue(tc, hm.try_emplace(n, n).second);
+    CuAssertTrue(tc, cap < hm.capacity());
+}
+
+void TesthashmapqCpp_HandlesCollisionsAndGrows(
+    CuTest * tc
+)
+{
+    qph::HashMap<unsigned long, unsigned long> hm(4);
+    unsigned long i;
+
+    /* std::hash is the identity for integers, so these all collide */
+    for (i = 1; i <= 1000; i++)
+        hm[i * 64] = i;
+
+    CuAssertTrue(tc, 1000 == hm.size());
+    for (i = 1; i <= 1000; i++)
+        CuAssertTrue(tc, i == hm.at(i * 64));
+}
+
+void TesthashmapqCpp_EraseWhileIterating(
+    CuTest * tc
+)
+{
+    qph::HashMap<int, int> hm;
+    int i, sum = 0;
+
+    for (i = 1; i <= 100; i++)
+        hm.emplace(i, i);
+
+    for (auto it = hm.begin(); it != hm.end();)
+    {
+        sum += it->second;
+        it = hm.erase(it);
+    }
+
+    CuAssertTrue(tc, 5050 == sum);
+    CuAssertTrue(tc, hm.empty());
+    hm.emplace(7, 7);
+    CuAssertTrue(tc, 1 == hm.erase(7));
+    CuAssertTrue(tc, 0 == hm.erase(7));
+}
+
+void TesthashmapqCpp_MoveOnlyValues(
+    CuTest * tc
+)
+{
+    qph::HashMap<int, std::unique_ptr<int>> hm;
+    int i;
+
+    for (i = 0; i < 100; i++)
+        hm.try_emplace(i, new int(i));
+
+    qph::HashMap<int, std::unique_ptr<int>> hm2(std::move(hm));
+    CuAssertTrue(tc, 0 == hm.size());
+    CuAssertTrue(tc, 100 == hm2.size());
+    for (i = 0; i < 100; i++)
+        CuAssertTrue(tc, i == *hm2.at(i));
+}
+
+void TesthashmapqCpp_TransparentLookup(
+    CuTest * tc
+)
+{
+    string_map_t hm;
+    std::string_view sv("needle");
+
+    hm.emplace("needle", 1);
+    hm.insert_or_assign(std::string("haystack"), 2);
+
+    CuAssertTrue(tc, hm.contains(sv));
+    CuAssertTrue(tc, 1 == hm.find(sv)->second);
+    CuAssertTrue(tc, !hm.contains(std::string_view("pin")));
+    CuAssertTrue(tc, 1 == hm.erase(std::string_view("haystack")));
+    CuAssertTrue(tc, 1 == hm.size());
+}
+
+void TesthashmapqCpp_TransparentEraseWhileIterating(
+    CuTest * tc
+)
+{
+    string_map_t hm;
+    int i, sum = 0;
+
+    for (i = 1; i <= 100; i++)
+        hm.emplace(std::to_string(i), i);
+
+    /* iterators must not bind to the transparent erase(const Q &) */
+    for (auto it = hm.begin(); it != hm.end();)
+    {
+        if (it->second % 2)
+        {
+            sum += it->second;
+            it = hm.erase(it);
+        }
+        else
+            ++it;
+    }
+
+    CuAssertTrue(tc, 2500 == sum);
+    CuAssertTrue(tc, 50 == hm.size());
+
+    string_map_t::const_iterator cit = hm.find(std::string_view("2"));
+    hm.erase(cit);
+    CuAssertTrue(tc, !hm.contains(std::string_view("2")));
+    CuAssertTrue(tc, 49 == hm.size());
+}
+
+void TesthashmapqCpp_CopyIsDeep(
+    CuTest * tc
+)
+{
+    string_map_t hm, hm2;
+
+    hm["a"] = 1;
+    hm2 = hm;
+    hm2["a"] = 2;
+    CuAssertTrue(tc, 1 == hm.at("a"));
+    CuAssertTrue(tc, 2 == hm2.at("a"));
+}
+
+}
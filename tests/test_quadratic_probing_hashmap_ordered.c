@@ -0,0 +1,109 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "CuTest.h"
+
+#include "quadratic_probing_hashmap_ordered.h"
+
+static unsigned long __uint_hash(
+    const void *e1
+)
+{
+    const long i1 = (unsigned long) e1;
+
+    assert(i1 >= 0);
+    return i1;
+}
+
+static long __uint_compare(
+    const void *e1,
+    const void *e2
+)
+{
+    const long i1 = (unsigned long) e1, i2 = (unsigned long) e2;
+
+    return i1 - i2;
+}
+
+void TesthashmapqOrdered_PutGetRemove(
+    CuTest * tc
+)
+{
+    hashmapq_ordered_t *hm;
+    unsigned long i;
+
+    hm = hashmapq_ordered_new(__uint_hash, __uint_compare, 4);
+    for (i = 1; i <= 1000; i++)
+        CuAssertTrue(tc, NULL == hashmapq_ordered_put(hm, (void *) i, (void *) i));
+    CuAssertTrue(tc, 1 == (unsigned long)
+                 hashmapq_ordered_put(hm, (void *) 1, (void *) 2));
+    CuAssertTrue(tc, 1000 == hashmapq_ordered_count(hm));
+
+    for (i = 2; i <= 1000; i++)
+        CuAssertTrue(tc, i == (unsigned long) hashmapq_ordered_get(hm, (void *) i));
+    CuAssertTrue(tc, 500 == (unsigned long)
+                 hashmapq_ordered_remove(hm, (void *) 500));
+    CuAssertTrue(tc, !hashmapq_ordered_contains_key(hm, (void *) 500));
+    CuAssertTrue(tc, 999 == hashmapq_ordered_count(hm));
+
+    hashmapq_ordered_clear(hm);
+    CuAssertTrue(tc, 0 == hashmapq_ordered_count(hm));
+    CuAssertTrue(tc, NULL == hashmapq_ordered_get(hm, (void *) 2));
+    hashmapq_ordered_freeall(hm);
+}
+
+void TesthashmapqOrdered_IteratesInInsertionOrder(
+    CuTest * tc
+)
+{
+    hashmapq_ordered_t *hm;
+    hashmapq_iterator_t iter;
+    unsigned long i, expected;
+    void *key;
+
+    hm = hashmapq_ordered_new(__uint_hash, __uint_compare, 4);
+    /* descending keys, so hash order and insertion order differ */
+    for (i = 400; i >= 1; i--)
+        hashmapq_ordered_put(hm, (void *) i, (void *) (i + 1000));
+    for (i = 2; i <= 400; i += 2)
+        hashmapq_ordered_remove(hm, (void *) i);
+    /* re-putting a key keeps its place */
+    hashmapq_ordered_put(hm, (void *) 399, (void *) 1399);
+
+    expected = 399;
+    hashmapq_ordered_iterator(hm, &iter);
+    while ((key = hashmapq_ordered_iterator_next(hm, &iter)))
+    {
+        CuAssertTrue(tc, expected == (unsigned long) key);
+        expected -= 2;
+    }
+    CuAssertTrue(tc, (unsigned long) -1 == expected);
+
+    hashmapq_ordered_iterator(hm, &iter);
+    CuAssertTrue(tc, 1399 == (unsigned long)
+                 hashmapq_ordered_iterator_next_value(hm, &iter));
+    hashmapq_ordered_freeall(hm);
+}
+
+void TesthashmapqOrdered_RemovedEntriesAreReclaimed(
+    CuTest * tc
+)
+{
+    hashmapq_ordered_t *hm;
+    unsigned long i;
+
+    hm = hashmapq_ordered_new(__uint_hash, __uint_compare, 64);
+    for (i = 1; i <= 10000; i++)
+    {
+        hashmapq_ordered_put(hm, (void *) i, (void *) i);
+        CuAssertTrue(tc, i == (unsigned long)
+                     hashmapq_ordered_remove(hm, (void *) i));
+    }
+
+    CuAssertTrue(tc, 0 == hashmapq_ordered_count(hm));
+    CuAssertTrue(tc, 64 == hashmapq_ordered_size(hm));
+    hashmapq_ordered_freeall(hm);
+}
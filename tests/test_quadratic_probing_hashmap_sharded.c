@@ -0,0 +1,155 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "CuTest.h"
+
+#include "quadratic_probing_hashmap_sharded.h"
+
+static unsigned long __uint_hash(
+    const void *e1
+)
+{
+    const long i1 = (unsigned long) e1;
+
+    assert(i1 >= 0);
+    return i1;
+}
+
+static long __uint_compare(
+    const void *e1,
+    const void *e2
+)
+{
+    const long i1 = (unsigned long) e1, i2 = (unsigned long) e2;
+
+    return i1 - i2;
+}
+
+void TesthashmapqSharded_PutGetRemove(
+    CuTest * tc
+)
+{
+    hashmapq_sharded_t *hm;
+    unsigned long i;
+
+    hm = hashmapq_sharded_new(__uint_hash, __uint_compare, 8, 4, 0);
+    for (i = 1; i <= 1000; i++)
+        CuAssertTrue(tc, NULL == hashmapq_sharded_put(hm, (void *) i, (void *) i));
+    CuAssertTrue(tc, 1 == (unsigned long)
+                 hashmapq_sharded_put(hm, (void *) 1, (void *) 2));
+    CuAssertTrue(tc, 1000 == hashmapq_sharded_count(hm));
+
+    for (i = 2; i <= 1000; i++)
+        CuAssertTrue(tc, i == (unsigned long) hashmapq_sharded_get(hm, (void *) i));
+    CuAssertTrue(tc, 500 == (unsigned long)
+                 hashmapq_sharded_remove(hm, (void *) 500));
+    CuAssertTrue(tc, !hashmapq_sharded_contains_key(hm, (void *) 500));
+    CuAssertTrue(tc, 999 == hashmapq_sharded_count(hm));
+
+    hashmapq_sharded_clear(hm);
+    CuAssertTrue(tc, 0 == hashmapq_sharded_count(hm));
+    hashmapq_sharded_freeall(hm);
+}
+
+static void __count_shard(
+    hashmapq_t * shard,
+    void *udata
+)
+{
+    int *nonempty = udata;
+
+    if (0 < hashmapq_count(shard))
+        (*nonempty)++;
+}
+
+void TesthashmapqSharded_SequentialKeysUseEveryShard(
+    CuTest * tc
+)
+{
+    hashmapq_sharded_t *hm;
+    unsigned long i;
+    int nonempty = 0;
+
+    hm = hashmapq_sharded_new(__uint_hash, __uint_compare, 16, 8, 0);
+    for (i = 1; i <= 256; i++)
+        hashmapq_sharded_put(hm, (void *) i, (void *) i);
+
+    hashmapq_sharded_for_each_shard(hm, __count_shard, &nonempty);
+    CuAssertTrue(tc, 16 == nonempty);
+    hashmapq_sharded_freeall(hm);
+}
+
+void TesthashmapqSharded_Iterate(
+    CuTest * tc
+)
+{
+    hashmapq_sharded_t *hm;
+    hashmapq_sharded_iterator_t iter;
+    unsigned long i, sum = 0;
+    void *key;
+
+    hm = hashmapq_sharded_new(__uint_hash, __uint_compare, 4, 8, 0);
+    for (i = 1; i <= 100; i++)
+        hashmapq_sharded_put(hm, (void *) i, (void *) i);
+
+    hashmapq_sharded_iterator(hm, &iter);
+    while ((key = hashmapq_sharded_iterator_next(hm, &iter)))
+    {
+        sum += (unsigned long) key;
+        hashmapq_sharded_remove(hm, key);
+    }
+
+    CuAssertTrue(tc, 5050 == sum);
+    CuAssertTrue(tc, 0 == hashmapq_sharded_count(hm));
+    hashmapq_sharded_freeall(hm);
+}
+
+#define SHARDED_KEYS_PER_THREAD 10000
+
+typedef struct
+{
+    hashmapq_sharded_t *hm;
+    unsigned long first;
+} __ingest_t;
+
+static void *__ingest(
+    void *arg
+)
+{
+    __ingest_t *in = arg;
+    unsigned long i;
+
+    for (i = in->first; i < in->first + SHARDED_KEYS_PER_THREAD; i++)
+        hashmapq_sharded_put(in->hm, (void *) i, (void *) i);
+    return NULL;
+}
+
+void TesthashmapqSharded_ConcurrentPuts(
+    CuTest * tc
+)
+{
+    hashmapq_sharded_t *hm;
+    pthread_t writers[4];
+    __ingest_t in[4];
+    unsigned long i;
+    int ii;
+
+    hm = hashmapq_sharded_new(__uint_hash, __uint_compare, 16, 4, 0);
+    for (ii = 0; ii < 4; ii++)
+    {
+        in[ii].hm = hm;
+        in[ii].first = 1 + ii * SHARDED_KEYS_PER_THREAD;
+        pthread_create(&writers[ii], NULL, __ingest, &in[ii]);
+    }
+    for (ii = 0; ii < 4; ii++)
+        pthread_join(writers[ii], NULL);
+
+    CuAssertTrue(tc, 4 * SHARDED_KEYS_PER_THREAD == hashmapq_sharded_count(hm));
+    for (i = 1; i <= 4 * SHARDED_KEYS_PER_THREAD; i++)
+        CuAssertTrue(tc, i == (unsigned long) hashmapq_sharded_get(hm, (void *) i));
+    hashmapq_sharded_freeall(hm);
+}
@@ -0,0 +1,157 @@
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <assert.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "CuTest.h"
+
+#include "quadratic_probing_hashmap_shared.h"
+
+static int __put_int(
+    hashmapq_shared_t * hm,
+    int key,
+    int val
+)
+{
+    return hashmapq_shared_put(hm, &key, sizeof(key), &val, sizeof(val));
+}
+
+/* @return key's val, otherwise -1 */
+static int __get_int(
+    hashmapq_shared_t * hm,
+    int key
+)
+{
+    int val;
+
+    if (-1 == hashmapq_shared_get(hm, &key, sizeof(key), &val, sizeof(val)))
+        return -1;
+    return val;
+}
+
+void TesthashmapqShared_PutGetRemove(
+    CuTest * tc
+)
+{
+    int fd = memfd_create("hashmapq", 0), i;
+    hashmapq_shared_t *hm, *other;
+    char val[16];
+
+    hm = hashmapq_shared_new(fd, 1 << 20, 8);
+    CuAssertTrue(tc, NULL != hm);
+    for (i = 0; i < 5000; i++)
+        CuAssertTrue(tc, 0 == __put_int(hm, i, i * 3));
+    CuAssertTrue(tc, 1 == __put_int(hm, 7, 1));
+    CuAssertTrue(tc, 5000 == hashmapq_shared_count(hm));
+    CuAssertTrue(tc, 0 == hashmapq_shared_remove(hm, &i, sizeof(i)));
+
+    /* a second mapping sees the same map */
+    other = hashmapq_shared_attach(fd);
+    CuAssertTrue(tc, NULL != other);
+    CuAssertTrue(tc, 1 == __get_int(other, 7));
+    for (i = 0; i < 5000; i += 2)
+        CuAssertTrue(tc, 1 == hashmapq_shared_remove(other, &i, sizeof(i)));
+    CuAssertTrue(tc, 2500 == hashmapq_shared_count(hm));
+    for (i = 1; i < 5000; i += 2)
+        CuAssertTrue(tc, (7 == i ? 1 : i * 3) == __get_int(hm, i));
+    CuAssertTrue(tc, -1 == __get_int(hm, 2));
+
+    /* vals are bytes, and are cut short to fit */
+    CuAssertTrue(tc, 0 == hashmapq_shared_put(hm, "key", 3, "a long value",
+                                              13));
+    CuAssertTrue(tc, 13 == hashmapq_shared_get(other, "key", 3, val, 4));
+    CuAssertTrue(tc, 0 == memcmp(val, "a lo", 4));
+    CuAssertTrue(tc, hashmapq_shared_contains_key(other, "key", 3));
+    CuAssertTrue(tc, !hashmapq_shared_contains_key(other, "ke", 2));
+
+    hashmapq_shared_clear(other);
+    CuAssertTrue(tc, 0 == hashmapq_shared_count(hm));
+    CuAssertTrue(tc, -1 == __get_int(hm, 1));
+
+    hashmapq_shared_detach(other);
+    hashmapq_shared_detach(hm);
+    close(fd);
+}
+
+void TesthashmapqShared_FullFileFailsPut(
+    CuTest * tc
+)
+{
+    int fd = memfd_create("hashmapq", 0), i, n;
+    hashmapq_shared_t *hm;
+    char big[1000] = { 0 };
+
+    hm = hashmapq_shared_new(fd, 64 << 10, 8);
+    for (n = 0; 0 == hashmapq_shared_put(hm, &n, sizeof(n), big,
+                                         sizeof(big)); n++)
+        ;
+    CuAssertTrue(tc, ENOSPC == errno);
+    CuAssertTrue(tc, n == hashmapq_shared_count(hm));
+    CuAssertTrue(tc, 0 < n);
+
+    for (i = n / 2; i < n; i++)
+        CuAssertTrue(tc, 1 == hashmapq_shared_remove(hm, &i, sizeof(i)));
+    n /= 2;
+
+    /* replaced vals pile up until collecting frees their space */
+    for (i = 0; i < 1000; i++)
+    {
+        int key = i % n;
+
+        CuAssertTrue(tc, 1 == hashmapq_shared_put(hm, &key, sizeof(key), big,
+                                                  sizeof(big)));
+    }
+    for (i = 0; i < n; i++)
+        CuAssertTrue(tc, sizeof(big) ==
+                     hashmapq_shared_get(hm, &i, sizeof(i), NULL, 0));
+
+    hashmapq_shared_detach(hm);
+    close(fd);
+}
+
+void TesthashmapqShared_ProcessesShareOneCopy(
+    CuTest * tc
+)
+{
+    int fd = memfd_create("hashmapq", 0), i, status, bad = 0;
+    hashmapq_shared_t *hm;
+    pid_t pid;
+
+    hm = hashmapq_shared_new(fd, 4 << 20, 8);
+    pid = fork();
+    if (0 == pid)
+    {
+        hashmapq_shared_t *child = hashmapq_shared_attach(fd);
+
+        /* growing and collecting while the parent reads */
+        for (i = 0; i < 20000; i++)
+            __put_int(child, i % 2000, i % 2000 * 7);
+        for (i = 0; i < 2000; i += 2)
+            hashmapq_shared_remove(child, &i, sizeof(i));
+        _exit(NULL == child);
+    }
+
+    while (0 == waitpid(pid, &status, WNOHANG))
+    {
+        for (i = 0; i < 2000; i++)
+        {
+            int val = __get_int(hm, i);
+
+            bad += -1 != val && i * 7 != val;
+        }
+    }
+
+    CuAssertTrue(tc, WIFEXITED(status) && 0 == WEXITSTATUS(status));
+    CuAssertTrue(tc, 0 == bad);
+    for (i = 0; i < 2000; i++)
+        CuAssertTrue(tc, (i % 2 ? i * 7 : -1) == __get_int(hm, i));
+
+    hashmapq_shared_detach(hm);
+    close(fd);
+}
@@ -0,0 +1,168 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "CuTest.h"
+
+#include "quadratic_probing_hashmap_swiss.h"
+
+static unsigned long __uint_hash(
+    const void *e1
+)
+{
+    const long i1 = (unsigned long) e1;
+
+    assert(i1 >= 0);
+    return i1;
+}
+
+static long __uint_compare(
+    const void *e1,
+    const void *e2
+)
+{
+    const long i1 = (unsigned long) e1, i2 = (unsigned long) e2;
+
+    return i1 - i2;
+}
+
+void TesthashmapqSwiss_New(
+    CuTest * tc
+)
+{
+    hashmapq_swiss_t *hm;
+
+    hm = hashmapq_swiss_new(__uint_hash, __uint_compare, 8);
+
+    CuAssertTrue(tc, 0 == hashmapq_swiss_count(hm));
+    /* never smaller than one group */
+    CuAssertTrue(tc, 16 <= hashmapq_swiss_size(hm));
+    hashmapq_swiss_freeall(hm);
+}
+
+void TesthashmapqSwiss_PutAndGet(
+    CuTest * tc
+)
+{
+    hashmapq_swiss_t *hm;
+
+    hm = hashmapq_swiss_new(__uint_hash, __uint_compare, 8);
+    CuAssertTrue(tc, NULL == hashmapq_swiss_put(hm, (void *) 50, (void *) 92));
+    CuAssertTrue(tc, 1 == hashmapq_swiss_count(hm));
+    CuAssertTrue(tc, 92 == (unsigned long) hashmapq_swiss_get(hm, (void *) 50));
+    CuAssertTrue(tc, NULL == hashmapq_swiss_get(hm, (void *) 51));
+    hashmapq_swiss_freeall(hm);
+}
+
+void TesthashmapqSwiss_DoublePutReplacesValue(
+    CuTest * tc
+)
+{
+    hashmapq_swiss_t *hm;
+
+    hm = hashmapq_swiss_new(__uint_hash, __uint_compare, 8);
+    hashmapq_swiss_put(hm, (void *) 50, (void *) 92);
+    CuAssertTrue(tc, 92 == (unsigned long)
+                 hashmapq_swiss_put(hm, (void *) 50, (void *) 23));
+    CuAssertTrue(tc, 23 == (unsigned long) hashmapq_swiss_get(hm, (void *) 50));
+    CuAssertTrue(tc, 1 == hashmapq_swiss_count(hm));
+    hashmapq_swiss_freeall(hm);
+}
+
+void TesthashmapqSwiss_TagCollisionsAreResolvedByCompare(
+    CuTest * tc
+)
+{
+    hashmapq_swiss_t *hm;
+
+    hm = hashmapq_swiss_new(__uint_hash, __uint_compare, 8);
+    /*  the following 3 share the same 7 bit tag: */
+    hashmapq_swiss_put(hm, (void *) 1, (void *) 92);
+    hashmapq_swiss_put(hm, (void *) 129, (void *) 91);
+    hashmapq_swiss_put(hm, (void *) 257, (void *) 90);
+    CuAssertTrue(tc, 92 == (unsigned long) hashmapq_swiss_get(hm, (void *) 1));
+    CuAssertTrue(tc, 91 == (unsigned long) hashmapq_swiss_get(hm, (void *) 129));
+    CuAssertTrue(tc, 90 == (unsigned long) hashmapq_swiss_get(hm, (void *) 257));
+    CuAssertTrue(tc, NULL == hashmapq_swiss_get(hm, (void *) 385));
+    hashmapq_swiss_freeall(hm);
+}
+
+void TesthashmapqSwiss_Remove(
+    CuTest * tc
+)
+{
+    hashmapq_swiss_t *hm;
+
+    hm = hashmapq_swiss_new(__uint_hash, __uint_compare, 8);
+    hashmapq_swiss_put(hm, (void *) 50, (void *) 92);
+    CuAssertTrue(tc, NULL == hashmapq_swiss_remove(hm, (void *) 51));
+    CuAssertTrue(tc, 92 == (unsigned long) hashmapq_swiss_remove(hm, (void *) 50));
+    CuAssertTrue(tc, 0 == hashmapq_swiss_count(hm));
+    CuAssertTrue(tc, NULL == hashmapq_swiss_get(hm, (void *) 50));
+    hashmapq_swiss_freeall(hm);
+}
+
+void TesthashmapqSwiss_GrowsAndKeepsEverything(
+    CuTest * tc
+)
+{
+    hashmapq_swiss_t *hm;
+    unsigned long i;
+
+    hm = hashmapq_swiss_new(__uint_hash, __uint_compare, 16);
+    for (i = 1; i <= 1000; i++)
+        hashmapq_swiss_put(hm, (void *) (i * 128), (void *) i);
+
+    CuAssertTrue(tc, 1000 == hashmapq_swiss_count(hm));
+    CuAssertTrue(tc, 1000 < hashmapq_swiss_size(hm));
+    for (i = 1; i <= 1000; i++)
+        CuAssertTrue(tc, i == (unsigned long)
+                     hashmapq_swiss_get(hm, (void *) (i * 128)));
+    hashmapq_swiss_freeall(hm);
+}
+
+void TesthashmapqSwiss_ChurnDoesNotGrowTable(
+    CuTest * tc
+)
+{
+    hashmapq_swiss_t *hm;
+    unsigned long i;
+
+    hm = hashmapq_swiss_new(__uint_hash, __uint_compare, 64);
+    for (i = 1; i <= 10000; i++)
+    {
+        hashmapq_swiss_put(hm, (void *) i, (void *) i);
+        CuAssertTrue(tc, i == (unsigned long) hashmapq_swiss_remove(hm, (void *) i));
+    }
+
+    CuAssertTrue(tc, 0 == hashmapq_swiss_count(hm));
+    CuAssertTrue(tc, 64 == hashmapq_swiss_size(hm));
+    hashmapq_swiss_freeall(hm);
+}
+
+void TesthashmapqSwiss_Iterate(
+    CuTest * tc
+)
+{
+    hashmapq_swiss_t *hm;
+    hashmapq_iterator_t iter;
+    unsigned long i, sum = 0;
+    void *key;
+
+    hm = hashmapq_swiss_new(__uint_hash, __uint_compare, 8);
+    for (i = 1; i <= 100; i++)
+        hashmapq_swiss_put(hm, (void *) i, (void *) i);
+
+    hashmapq_swiss_iterator(hm, &iter);
+    while ((key = hashmapq_swiss_iterator_next(hm, &iter)))
+    {
+        sum += (unsigned long) key;
+        hashmapq_swiss_remove(hm, key);
+    }
+
+    CuAssertTrue(tc, 5050 == sum);
+    CuAssertTrue(tc, 0 == hashmapq_swiss_count(hm));
+    hashmapq_swiss_freeall(hm);
+}
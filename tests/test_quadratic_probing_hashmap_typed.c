@@ -0,0 +1,130 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "CuTest.h"
+
+#include "quadratic_probing_hashmap_typed.h"
+
+typedef struct
+{
+    uint32_t src, dst;
+    uint16_t sport, dport;
+} flow_t;
+
+static unsigned long __flow_hash(
+    flow_t f
+)
+{
+    return ((unsigned long) f.src * 31 + f.dst) * 31 + f.sport * 7 + f.dport;
+}
+
+static int __flow_eq(
+    flow_t a,
+    flow_t b
+)
+{
+    return a.src == b.src && a.dst == b.dst &&
+        a.sport == b.sport && a.dport == b.dport;
+}
+
+QPH_DECLARE(u64, uint64_t, uint64_t, QPH_INT_HASH, QPH_INT_EQ)
+QPH_DECLARE(flow, flow_t, void *, __flow_hash, __flow_eq)
+
+void TesthashmapqTyped_ZeroKeysAndValuesAreAllowed(
+    CuTest * tc
+)
+{
+    hashmapq_u64_t *hm;
+    uint64_t old;
+
+    hm = hashmapq_u64_new(8);
+    CuAssertTrue(tc, 0 == hashmapq_u64_put(hm, 0, 0, NULL));
+    CuAssertTrue(tc, 1 == hashmapq_u64_count(hm));
+    CuAssertTrue(tc, NULL != hashmapq_u64_get(hm, 0));
+    CuAssertTrue(tc, 0 == *hashmapq_u64_get(hm, 0));
+
+    CuAssertTrue(tc, 1 == hashmapq_u64_put(hm, 0, 5, &old));
+    CuAssertTrue(tc, 0 == old);
+    CuAssertTrue(tc, 5 == *hashmapq_u64_get(hm, 0));
+    CuAssertTrue(tc, 1 == hashmapq_u64_count(hm));
+    hashmapq_u64_freeall(hm);
+}
+
+void TesthashmapqTyped_GetReturnsValueSlot(
+    CuTest * tc
+)
+{
+    hashmapq_u64_t *hm;
+
+    hm = hashmapq_u64_new(8);
+    hashmapq_u64_put(hm, 50, 92, NULL);
+    (*hashmapq_u64_get(hm, 50))++;
+    CuAssertTrue(tc, 93 == *hashmapq_u64_get(hm, 50));
+    CuAssertTrue(tc, NULL == hashmapq_u64_get(hm, 51));
+    hashmapq_u64_freeall(hm);
+}
+
+void TesthashmapqTyped_RemoveHandlesCollision(
+    CuTest * tc
+)
+{
+    hashmapq_u64_t *hm;
+    uint64_t val = 0;
+
+    hm = hashmapq_u64_new(4);
+    hashmapq_u64_put(hm, 1, 92, NULL);
+    hashmapq_u64_put(hm, 5, 93, NULL);
+    hashmapq_u64_put(hm, 9, 94, NULL);
+
+    CuAssertTrue(tc, 1 == hashmapq_u64_remove(hm, 5, &val));
+    CuAssertTrue(tc, 93 == val);
+    CuAssertTrue(tc, 0 == hashmapq_u64_remove(hm, 5, &val));
+    CuAssertTrue(tc, 2 == hashmapq_u64_count(hm));
+    CuAssertTrue(tc, 94 == *hashmapq_u64_get(hm, 9));
+    hashmapq_u64_freeall(hm);
+}
+
+void TesthashmapqTyped_GrowsAndIterates(
+    CuTest * tc
+)
+{
+    hashmapq_u64_t *hm;
+    hashmapq_iterator_t iter;
+    uint64_t i, key, val, sum = 0;
+
+    hm = hashmapq_u64_new(1);
+    for (i = 0; i < 1000; i++)
+        hashmapq_u64_put(hm, i * 64, i, NULL);
+    CuAssertTrue(tc, 1000 == hashmapq_u64_count(hm));
+
+    hashmapq_u64_iterator(hm, &iter);
+    while (hashmapq_u64_iterator_next(hm, &iter, &key, &val))
+    {
+        CuAssertTrue(tc, key == val * 64);
+        sum += val;
+        hashmapq_u64_remove(hm, key, NULL);
+    }
+
+    CuAssertTrue(tc, 999 * 1000 / 2 == sum);
+    CuAssertTrue(tc, 0 == hashmapq_u64_count(hm));
+    hashmapq_u64_freeall(hm);
+}
+
+void TesthashmapqTyped_StructKeys(
+    CuTest * tc
+)
+{
+    hashmapq_flow_t *hm;
+    flow_t a = { 1, 2, 80, 1024 }, b = { 1, 2, 80, 1025 };
+
+    hm = hashmapq_flow_new(8);
+    hashmapq_flow_put(hm, a, NULL, NULL);
+    CuAssertTrue(tc, hashmapq_flow_contains_key(hm, a));
+    CuAssertTrue(tc, !hashmapq_flow_contains_key(hm, b));
+    CuAssertTrue(tc, NULL == *hashmapq_flow_get(hm, a));
+    hashmapq_flow_freeall(hm);
+}